@@ -0,0 +1,223 @@
+#include "cpu.h"
+
+/*
+	Cached interpreter
+
+	Straight-line runs of ROM code are decoded once into arrays of handler + operand
+	pairs and executed from there, so the opcode and its operands are not read
+	through Memory again and no table lookup is made per instruction.
+
+	Only cartridge ROM ($0000 - $7FFF) is cached. Blocks in the switchable bank
+	window are keyed by the bank that was mapped when they were decoded, so a bank
+	switch just selects another set of blocks. Code running from RAM may be
+	modified at any time and always goes through step().
+
+	The clock is moved past each instruction before the next one starts. An instruction
+	that could run past the next scheduler deadline is stepped instead and ends the block,
+	as does one that asks for a sync, so timers, LCD and interrupts see exactly what they
+	see when stepping. Compiled blocks only run when the whole block fits before the deadline.
+*/
+
+// Instructions after which execution may not continue at the next address,
+// or after which interrupts have to be looked at before going on
+bool CPU::ends_block(Opcode code)
+{
+	switch (code)
+	{
+		case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+		case 0xCD: case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL
+		case 0xC9: case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xD9: // RET, RETI
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+		case 0xE9: // JP (HL)
+		case 0x76: case 0x10: // HALT, STOP
+		case 0xF3: case 0xFB: // DI, EI
+			return true;
+		default:
+			return false;
+	}
+}
+
+unique_ptr<CPU::BasicBlock> CPU::decode_block(Address location)
+{
+	unique_ptr<BasicBlock> block(new BasicBlock());
+	Address region_end = (location < 0x4000) ? 0x4000 : 0x8000;
+
+	while ((int)block->ops.size() < MAX_BLOCK_LENGTH)
+	{
+		Opcode code = memory->fetch(location);
+		int length = OPCODE_TABLE[code].length;
+
+		// instruction would run past the bank window
+		if (location + length > region_end)
+			break;
+
+		MicroOp micro_op;
+		micro_op.handler = instructions[code];
+		micro_op.operands[0] = 0;
+		micro_op.code = code;
+		micro_op.length = 1;
+
+		if (length == 2)
+			micro_op.operands[0] = memory->fetch(location + 1);
+		else if (length == 3)
+			micro_op.operands[0] = combine(memory->fetch(location + 2), memory->fetch(location + 1));
+
+		// CB prefixed instructions go straight to their bit operation handler
+		if (code == 0xCB)
+			micro_op.handler = bit_instructions[micro_op.operands[0]];
+
+		micro_op.cycles = OPCODE_TABLE[(code == 0xCB) ? CB_PREFIXED + micro_op.operands[0] : code].taken_cycles * 4;
+		block->cycles += micro_op.cycles;
+
+		// LDH and LD (nn) into the I/O page
+		if (code == 0xE0 || code == 0xF0 || code == 0xE2 || code == 0xF2 ||
+			((code == 0xEA || code == 0xFA) && micro_op.operands[0] >= 0xFF00))
+			block->touches_io = true;
+
+		block->ops.push_back(micro_op);
+		location += length;
+
+		if (ends_block(code) || location == region_end)
+			break;
+	}
+
+	if (use_fusion)
+		fuse(block->ops);
+
+	blocks_decoded++;
+	return block;
+}
+
+// Replaces the idioms in fusion_patterns with a single micro op each
+void CPU::fuse(vector<MicroOp>& ops)
+{
+	vector<MicroOp> fused;
+	size_t i = 0;
+
+	while (i < ops.size())
+	{
+		const FusionPattern* match = nullptr;
+
+		for (const FusionPattern& pattern : fusion_patterns)
+		{
+			if (i + pattern.codes.size() > ops.size())
+				continue;
+
+			bool same = true;
+
+			for (size_t j = 0; j < pattern.codes.size() && same; j++)
+				same = (ops[i + j].code == pattern.codes[j]);
+
+			if (same)
+			{
+				match = &pattern;
+				break;
+			}
+		}
+
+		if (!match)
+		{
+			fused.push_back(ops[i++]);
+			continue;
+		}
+
+		MicroOp micro_op = ops[i];
+		micro_op.handler = match->handler;
+		micro_op.length = (Byte)match->codes.size();
+
+		micro_op.cycles = 0;
+
+		for (size_t j = 0; j < match->codes.size(); j++)
+		{
+			micro_op.operands[j] = ops[i + j].operands[0];
+			micro_op.cycles += ops[i + j].cycles;
+		}
+
+		fused.push_back(micro_op);
+		i += match->codes.size();
+	}
+
+	ops.swap(fused);
+}
+
+CPU::BasicBlock* CPU::find_block(Address location)
+{
+	int bank = memory->get_rom_bank(location);
+
+	if (bank >= (int)block_cache.size())
+		block_cache.resize(bank + 1);
+
+	vector<unique_ptr<BasicBlock>>& blocks = block_cache[bank];
+
+	if (blocks.empty())
+		blocks.resize(0x4000);
+
+	unique_ptr<BasicBlock>& block = blocks[location & 0x3FFF];
+
+	if (!block)
+		block = decode_block(location);
+
+	return block.get();
+}
+
+// Runs the block at PC, returns the number of instructions executed
+int CPU::run_block()
+{
+	// blocks are only decoded and run from ROM, which OAM DMA makes unreadable
+	if (reg.PC >= 0x8000 || memory->dma_cycles > 0)
+	{
+		step();
+		return 1;
+	}
+
+	BasicBlock* block = find_block(reg.PC);
+	unsigned int controller_writes = memory->controller_writes;
+	int executed = 0;
+
+	if (use_jit && !block->compiled && !block->touches_io && ++block->executions == JIT_THRESHOLD)
+		block->compiled = compile_block(block);
+
+	executing_block = true;
+
+	// compiled code only checks for sync requests, so all of it has to fit before the deadline
+	if (block->compiled && scheduler->now + block->cycles <= scheduler->next)
+	{
+		executed = block->compiled(this);
+		executing_block = false;
+		return executed;
+	}
+
+	for (const MicroOp& micro_op : block->ops)
+	{
+		// reads of DIV, TIMA and LY see the instructions before this one on the clock
+		scheduler->now += num_cycles;
+		num_cycles = 0;
+
+		// stop where step() would: an instruction that could run past the next deadline is
+		// stepped instead, and nothing runs after one that asked for a sync
+		if (scheduler->now + micro_op.cycles > scheduler->next)
+		{
+			executing_block = false;
+
+			if (executed == 0 || scheduler->now < scheduler->next)
+			{
+				step();
+				executed++;
+			}
+
+			break;
+		}
+
+		block_operands = micro_op.operands;
+		(this->*micro_op.handler)();
+		executed += micro_op.length;
+
+		// a bank switch may have replaced the code the rest of the block was decoded from
+		if (memory->controller_writes != controller_writes)
+			break;
+	}
+
+	executing_block = false;
+	return executed;
+}
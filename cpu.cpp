@@ -6,9 +6,10 @@
 */
 
 //     
-void CPU::init(Memory* _memory)
+void CPU::init(Memory* _memory, Scheduler* _scheduler)
 {
 	memory = _memory;
+	scheduler = _scheduler;
 	reset();
 }
 
@@ -29,49 +30,33 @@ void CPU::reset()
 		*      ,  ROM ,  
 		   0x100    .
 	*/
-	reg_A = 0x01;
-	reg_B = 0x00;
-	reg_C = 0x13;
-	reg_D = 0x00;
-	reg_E = 0xD8;
-	reg_F = 0xB0;
-	reg_H = 0x01;
-	reg_L = 0x4D;
-	reg_SP = 0xFFFE;
-	reg_PC = 0x100;
+	reg.A = 0x01;
+	reg.B = 0x00;
+	reg.C = 0x13;
+	reg.D = 0x00;
+	reg.E = 0xD8;
+	load_flags(0xB0);
+	reg.H = 0x01;
+	reg.L = 0x4D;
+	reg.SP = 0xFFFE;
+	reg.PC = 0x100;
 }
 
 void CPU::save_state(ofstream &file)
 {
-	file.write((char*)&reg_A, sizeof(reg_A));
-	file.write((char*)&reg_B, sizeof(reg_B));
-	file.write((char*)&reg_C, sizeof(reg_C));
-	file.write((char*)&reg_D, sizeof(reg_D));
-	file.write((char*)&reg_E, sizeof(reg_E));
-	file.write((char*)&reg_F, sizeof(reg_F));
-	file.write((char*)&reg_H, sizeof(reg_H));
-	file.write((char*)&reg_L, sizeof(reg_L));
-	file.write((char*)&reg_SP, sizeof(reg_SP));
-	file.write((char*)&reg_PC, sizeof(reg_PC));
+	flags();
+	file.write((char*)&reg, sizeof(reg));
 }
 
 void CPU::load_state(ifstream &file)
 {
-	file.read((char*)&reg_A, sizeof(reg_A));
-	file.read((char*)&reg_B, sizeof(reg_B));
-	file.read((char*)&reg_C, sizeof(reg_C));
-	file.read((char*)&reg_D, sizeof(reg_D));
-	file.read((char*)&reg_E, sizeof(reg_E));
-	file.read((char*)&reg_F, sizeof(reg_F));
-	file.read((char*)&reg_H, sizeof(reg_H));
-	file.read((char*)&reg_L, sizeof(reg_L));
-	file.read((char*)&reg_SP, sizeof(reg_SP));
-	file.read((char*)&reg_PC, sizeof(reg_PC));
+	file.read((char*)&reg, sizeof(reg));
+	lazy_flags.operation = FLAGS_NONE;
 }
 
 void CPU::op(int pc, int cycle)
 {
-	reg_PC += pc;
+	reg.PC += pc;
 
 	/*
 		   4,    
@@ -83,264 +68,346 @@ void CPU::op(int pc, int cycle)
 	num_cycles += (cycle * 4);
 }
 
-void CPU::set_flag(int flag, bool value)
+// Fetch and execute the instruction at PC
+template <class Timing>
+void CPU::step()
 {
-	if (value == true)
-		reg_F |= flag;
-	else
-		reg_F &= ~(flag);
-}
+	Opcode code = memory->fetch(reg.PC);
+	memory_reads++;
 
-//  8 
+	if (profile)
+		opcode_counts[code]++;
 
-void CPU::LD(Byte& destination, Byte value)
-{
-	destination = value;
+	parse_opcode<Timing>(code);
 }
 
-void CPU::LD(Byte& destination, Address addr)
+// Register file with the flags evaluated
+Registers CPU::get_registers()
 {
-	destination = memory->read(addr);
+	flags();
+	return reg;
 }
 
-void CPU::LD(Address addr, Byte value)
+/*
+	True when the code at location is a short loop that only loads memory into A,
+	tests it and branches back to location. Such a loop changes nothing but the
+	cycle count until the memory it reads changes (see Emulator::skip_idle_loop).
+*/
+bool CPU::is_polling_loop(Address location)
 {
-	memory->write(addr, value);
-}
+	Address pc = location;
 
-//  16 
+	for (int i = 0; i < 8; i++)
+	{
+		Opcode code = memory->fetch(pc);
+
+		switch (code)
+		{
+			// the branch back to the start ends the loop
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+				return (Address)(pc + 2 + (Byte_Signed)memory->fetch(pc + 1)) == location;
+			case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+				return combine(memory->fetch(pc + 2), memory->fetch(pc + 1)) == location;
+
+			// loads into A
+			case 0x0A: case 0x1A: case 0x7E: case 0xF0: case 0xF2: case 0xFA:
+			case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7F:
+			// AND, XOR, OR, CP with a register, (HL) or an immediate
+			case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+				break;
+
+			// BIT b, r
+			case 0xCB:
+				if (memory->fetch(pc + 1) < 0x40 || memory->fetch(pc + 1) > 0x7F)
+					return false;
+				break;
+
+			default:
+				if (code < 0xA0 || code > 0xBF)
+					return false;
+		}
+
+		pc += OPCODE_TABLE[code].length;
+	}
+
+	return false;
+}
 
-void CPU::LD(Pair reg_pair, Byte upper, Byte lower)
+// Memory accesses made by instructions, counted for profiling
+Byte CPU::read(Address location)
 {
-	reg_pair.set(upper, lower);
+	memory_reads++;
+	return memory->read(location);
 }
 
-void CPU::LD(Byte_2& reg_pair, Byte upper, Byte lower)
+void CPU::write(Address location, Byte data)
 {
-	reg_pair = combine(upper, lower);
+	memory->write(location, data);
 }
 
-void CPU::LDHL(Byte value)
+// Operand bytes following the current opcode, read through the instruction fetch path
+// (blocks from the block cache already carry their operands)
+Byte CPU::imm8()
 {
-	//   -128  +127,     ,   ?
+	if (executing_block)
+		return low_byte(*block_operands);
 
-	Byte_2_Signed signed_val = (Byte_2_Signed) (Byte_Signed) value;
-	Byte_2 result = (Byte_2) ((Byte_2_Signed) reg_SP + signed_val);
+	memory_reads++;
+	return memory->fetch(reg.PC + 1);
+}
 
-	set_flag(FLAG_CARRY, (result & 0xFF) < (reg_SP & 0xFF)); // ,     15
-	set_flag(FLAG_HALF_CARRY, (result & 0xF) < (reg_SP & 0xF)); // ,     11
-	set_flag(FLAG_ZERO, false); // 
-	set_flag(FLAG_SUB, false); // 
+Address CPU::imm16()
+{
+	if (executing_block)
+		return *block_operands;
 
-	Pair(reg_H, reg_L).set(result);
+	memory_reads += 2;
+	return combine(memory->fetch(reg.PC + 2), memory->fetch(reg.PC + 1));
 }
 
-void CPU::LDNN(Byte low, Byte high)
+void CPU::set_flag(int flag, bool value)
 {
-	Byte lsb = low_byte(reg_SP);
-	Byte msb = high_byte(reg_SP);
-
-	Address addr = Pair(high, low).address();
+	flags();
 
-	LD(addr++, lsb);
-	LD(addr, msb);
+	if (value == true)
+		reg.F |= flag;
+	else
+		reg.F &= ~(flag);
 }
 
-//   
+/*
+	Lazy flag evaluation
 
-void CPU::PUSH(Byte high, Byte low)
+	ALU helpers only record the operation, its operands and result. reg.F is
+	materialized by flags() when something needs the whole register
+	(PUSH AF, DAA, set_flag, save states); conditional instructions ask for
+	just the zero or carry flag, which is cheaper to derive.
+	Building with LAZY_FLAGS=0 materializes immediately after every operation.
+*/
+void CPU::defer_flags(FlagOperation operation, Byte a, Byte b, Byte carry, Byte result)
 {
-	memory->write(--reg_SP, high);
-	memory->write(--reg_SP, low);
+	lazy_flags.operation = operation;
+	lazy_flags.a = a;
+	lazy_flags.b = b;
+	lazy_flags.carry = carry;
+	lazy_flags.result = result;
+
+#if !LAZY_FLAGS
+	flags();
+#endif
 }
 
-void CPU::POP(Byte& high, Byte& low)
+Byte CPU::flags()
 {
-	low = memory->read(reg_SP++);
-	high = memory->read(reg_SP++);
-}
+	LazyFlags& lazy = lazy_flags;
 
-//   ALU
+	if (lazy.operation == FLAGS_NONE)
+		return reg.F;
 
-void CPU::ADD(Byte& target, Byte value)
-{
-	Byte_2 result = (Byte_2) target + (Byte_2) value;
+	Byte zero = zero_flag() ? FLAG_ZERO : 0;
+	Byte carry = carry_flag() ? FLAG_CARRY : 0;
 
-	set_flag(FLAG_HALF_CARRY, ((target & 0xF) + (value & 0xF)) > 0xF);
-	set_flag(FLAG_CARRY, (result > 0xFF));
-	set_flag(FLAG_ZERO, (result & 0xFF) == 0);
-	set_flag(FLAG_SUB, false);
+	switch (lazy.operation)
+	{
+	case FLAGS_ADD:
+		reg.F = zero | carry | ((((lazy.a & 0xF) + (lazy.b & 0xF) + lazy.carry) > 0xF) ? FLAG_HALF_CARRY : 0);
+		break;
+	case FLAGS_SUB:
+		reg.F = zero | carry | FLAG_SUB | ((((lazy.a & 0xF) - (lazy.b & 0xF) - lazy.carry) < 0) ? FLAG_HALF_CARRY : 0);
+		break;
+	case FLAGS_INC:
+		reg.F = zero | carry | (((lazy.a & 0xF) == 0xF) ? FLAG_HALF_CARRY : 0);
+		break;
+	case FLAGS_DEC:
+		reg.F = zero | carry | FLAG_SUB | (((lazy.a & 0xF) == 0) ? FLAG_HALF_CARRY : 0);
+		break;
+	case FLAGS_AND:
+		reg.F = zero | FLAG_HALF_CARRY;
+		break;
+	default: // FLAGS_OR, FLAGS_SHIFT
+		reg.F = zero | carry;
+		break;
+	}
 
-	target = (result & 0xFF);
+	lazy.operation = FLAGS_NONE;
+	return reg.F;
 }
 
-void CPU::ADD(Byte& target, Address addr)
+bool CPU::zero_flag()
 {
-	Byte val = memory->read(addr);
-	ADD(target, val);
+	switch (lazy_flags.operation)
+	{
+	case FLAGS_NONE:
+		return (reg.F & FLAG_ZERO) != 0;
+	case FLAGS_SHIFT:
+		// a holds whether this rotate sets the zero flag at all
+		return lazy_flags.a && lazy_flags.result == 0;
+	default:
+		return lazy_flags.result == 0;
+	}
 }
 
-void CPU::ADC(Byte& target, Byte value)
+bool CPU::carry_flag()
 {
-	Byte_2 carry = (reg_F & FLAG_CARRY) ? 1 : 0;
-	Byte_2 result = (Byte_2) target + (Byte_2) value + carry;
+	LazyFlags& lazy = lazy_flags;
 
-	set_flag(FLAG_HALF_CARRY, ((target & 0x0F) + (value & 0xF) + (Byte) carry) > 0x0F);
-	set_flag(FLAG_CARRY, (result > 0xFF));
-	set_flag(FLAG_ZERO, (result & 0xFF) == 0);
-	set_flag(FLAG_SUB, false);
-
-	target = (result & 0xFF);
+	switch (lazy.operation)
+	{
+	case FLAGS_NONE:
+		return (reg.F & FLAG_CARRY) != 0;
+	case FLAGS_ADD:
+		return (lazy.a + lazy.b + lazy.carry) > 0xFF;
+	case FLAGS_SUB:
+		return (lazy.a - lazy.b - lazy.carry) < 0;
+	case FLAGS_AND:
+	case FLAGS_OR:
+		return false;
+	default: // FLAGS_INC, FLAGS_DEC and FLAGS_SHIFT carry their carry flag along
+		return lazy.carry != 0;
+	}
 }
 
-void CPU::ADC(Byte& target, Address addr)
+// Overwrites the whole flag register, dropping any pending lazy flags
+void CPU::load_flags(Byte value)
 {
-	Byte val = memory->read(addr);
-	ADC(target, val);
+	reg.F = value;
+	lazy_flags.operation = FLAGS_NONE;
 }
 
-void CPU::SUB(Byte& target, Byte value)
-{
-	Byte_2_Signed result = (Byte_2_Signed)target - (Byte_2_Signed)value;
-
-	Byte_2_Signed s_target = (Byte_2_Signed)target;
-	Byte_2_Signed s_value = (Byte_2_Signed)value;
-
-	set_flag(FLAG_HALF_CARRY, (((s_target & 0xF) - (s_value & 0xF)) < 0));
-	set_flag(FLAG_CARRY, result < 0);
-	set_flag(FLAG_SUB, true);
-	set_flag(FLAG_ZERO, (result & 0xFF) == 0);
+//  8 
 
-	target = (Byte)(result & 0xFF);
+void CPU::LD(Byte& destination, Byte value)
+{
+	destination = value;
 }
 
-void CPU::SUB(Byte& target, Address addr)
+//  16 
+
+void CPU::LD16(Byte_2& reg_pair, Byte_2 value)
 {
-	Byte val = memory->read(addr);
-	SUB(target, val);
+	reg_pair = value;
 }
 
-void CPU::SBC(Byte& target, Byte value)
+void CPU::LDHL(Byte value)
 {
-	Byte_2 carry = (reg_F & FLAG_CARRY) ? 1 : 0;
-	Byte_2_Signed result = (Byte_2_Signed)target - (Byte_2_Signed)value - carry;
+	//   -128  +127,     ,   ?
 
-	Byte_2_Signed s_target = (Byte_2_Signed)target;
-	Byte_2_Signed s_value = (Byte_2_Signed)value;
+	Byte_2_Signed signed_val = (Byte_2_Signed) (Byte_Signed) value;
+	Byte_2 result = (Byte_2) ((Byte_2_Signed) reg.SP + signed_val);
 
-	set_flag(FLAG_HALF_CARRY, (((s_target & 0xF) - (s_value & 0xF) - carry) < 0));
-	set_flag(FLAG_CARRY, result < 0);
-	set_flag(FLAG_SUB, true);
-	set_flag(FLAG_ZERO, (result & 0xFF) == 0);
+	set_flag(FLAG_CARRY, (result & 0xFF) < (reg.SP & 0xFF)); // ,     15
+	set_flag(FLAG_HALF_CARRY, (result & 0xF) < (reg.SP & 0xF)); // ,     11
+	set_flag(FLAG_ZERO, false); // 
+	set_flag(FLAG_SUB, false); // 
 
-	target = (Byte) (result & 0xFF);
+	reg.HL = result;
 }
 
-void CPU::SBC(Byte& target, Address addr)
+template <class Timing>
+void CPU::LDNN(Address addr)
 {
-	Byte val = memory->read(addr);
-	SBC(target, val);
+	Byte lsb = low_byte(reg.SP);
+	Byte msb = high_byte(reg.SP);
+
+	write<Timing>(addr++, lsb);
+	write<Timing>(addr, msb);
 }
 
-void CPU::AND(Byte& target, Byte value)
+//   
+
+template <class Timing>
+void CPU::PUSH(Byte_2 reg_pair)
 {
-	target &= value;
+	write<Timing>(--reg.SP, high_byte(reg_pair));
+	write<Timing>(--reg.SP, low_byte(reg_pair));
+}
 
-	set_flag(FLAG_ZERO, (target == 0));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, true);
-	set_flag(FLAG_CARRY, false);
+template <class Timing>
+void CPU::POP(Byte_2& reg_pair)
+{
+	Byte low = read<Timing>(reg.SP++);
+	Byte high = read<Timing>(reg.SP++);
+
+	reg_pair = combine(high, low);
 }
 
-void CPU::AND(Byte& target, Address addr)
+//   ALU
+
+void CPU::ADD(Byte& target, Byte value)
 {
-	Byte val = memory->read(addr);
-	AND(target, val);
+	Byte result = target + value;
+	defer_flags(FLAGS_ADD, target, value, 0, result);
+
+	target = result;
 }
 
-void CPU::OR(Byte& target, Byte value)
+void CPU::ADC(Byte& target, Byte value)
 {
-	target |= value;
+	Byte carry = carry_flag();
+	Byte result = target + value + carry;
+	defer_flags(FLAGS_ADD, target, value, carry, result);
 
-	set_flag(FLAG_ZERO, (target == 0));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_CARRY, false);
+	target = result;
 }
 
-void CPU::OR(Byte& target, Address addr)
+void CPU::SUB(Byte& target, Byte value)
 {
-	Byte val = memory->read(addr);
-	OR(target, val);
+	Byte result = target - value;
+	defer_flags(FLAGS_SUB, target, value, 0, result);
+
+	target = result;
 }
 
-void CPU::XOR(Byte& target, Byte value)
+void CPU::SBC(Byte& target, Byte value)
 {
-	target ^= value;
+	Byte carry = carry_flag();
+	Byte result = target - value - carry;
+	defer_flags(FLAGS_SUB, target, value, carry, result);
 
-	set_flag(FLAG_ZERO, (target == 0));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_CARRY, false);
+	target = result;
 }
 
-void CPU::XOR(Byte& target, Address addr)
+void CPU::AND(Byte& target, Byte value)
 {
-	Byte val = memory->read(addr);
-	XOR(target, val);
+	target &= value;
+	defer_flags(FLAGS_AND, 0, 0, 0, target);
 }
-//  A  n.     A - n,   
 
-void CPU::CP(Byte& target, Byte value)
+void CPU::OR(Byte& target, Byte value)
 {
-	int result = target - value;
+	target |= value;
+	defer_flags(FLAGS_OR, 0, 0, 0, target);
+}
 
-	set_flag(FLAG_ZERO, (result == 0)); // ,    
-	set_flag(FLAG_SUB, true); // 
-	set_flag(FLAG_HALF_CARRY, (((target & 0xF) - (value & 0xF)) < 0));
-	set_flag(FLAG_CARRY, (result < 0)); // ,  
+void CPU::XOR(Byte& target, Byte value)
+{
+	target ^= value;
+	defer_flags(FLAGS_OR, 0, 0, 0, target);
 }
 
-void CPU::CP(Byte& target, Address addr)
+//  A  n.     A - n,   
+
+void CPU::CP(Byte& target, Byte value)
 {
-	Byte val = memory->read(addr);
-	CP(target, val);
+	defer_flags(FLAGS_SUB, target, value, 0, target - value);
 }
 
 void CPU::INC(Byte& target)
 {
 	Byte result = target + 1;
-	set_flag(FLAG_ZERO, (result == 0));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, ((((target & 0xF) + 1) & 0x10) != 0));
+	defer_flags(FLAGS_INC, target, 0, carry_flag(), result);
 
 	target = result;
 }
 
-void CPU::INC(Address addr)
-{
-	Byte value = memory->read(addr);
-	INC(value);
-	memory->write(addr, value);
-}
-
 void CPU::DEC(Byte& target)
 {
 	Byte result = target - 1;
-	set_flag(FLAG_ZERO, (result == 0));
-	set_flag(FLAG_SUB, true);
-	set_flag(FLAG_HALF_CARRY, (((target & 0xF) - 1) < 0));
+	defer_flags(FLAGS_DEC, target, 0, carry_flag(), result);
 
 	target = result;
 }
 
-void CPU::DEC(Address addr)
-{
-	Byte value = memory->read(addr);
-	DEC(value);
-	memory->write(addr, value);
-}
-
 //  16 
 
 void CPU::ADD16(Byte_2 target, Byte_2 value)
@@ -351,177 +418,71 @@ void CPU::ADD16(Byte_2 target, Byte_2 value)
 	set_flag(FLAG_CARRY, (result > 0xFFFF)); // ,     15
 }
 
-void CPU::ADDHL(Pair reg_pair)
+void CPU::ADDHL(Byte_2 value)
 {
-	Byte_2 target = Pair(reg_H, reg_L).get();
-	Byte_2 value = reg_pair.get();
+	Byte_2 target = reg.HL;
 	Byte_2 result = target + value;
 
 	ADD16(target, value); //   
 	
-	Pair(reg_H, reg_L).set(result);
-}
-
-void CPU::ADDHLSP()
-{
-	Byte high = high_byte(reg_SP);
-	Byte low = low_byte(reg_SP);
-
-	ADDHL(Pair(high, low));
+	reg.HL = result;
 }
 
 void CPU::ADDSP(Byte value)
 {
 	Byte_2_Signed val_signed = (Byte_2_Signed) (Byte_Signed) value;
-	Byte_2 result = (Byte_2) ((Byte_2_Signed) reg_SP + val_signed);
+	Byte_2 result = (Byte_2) ((Byte_2_Signed) reg.SP + val_signed);
 
-	set_flag(FLAG_CARRY, (result & 0xFF) < (reg_SP & 0xFF));
-	set_flag(FLAG_HALF_CARRY, (result & 0xF) < (reg_SP & 0xF));
+	set_flag(FLAG_CARRY, (result & 0xFF) < (reg.SP & 0xFF));
+	set_flag(FLAG_HALF_CARRY, (result & 0xF) < (reg.SP & 0xF));
 	set_flag(FLAG_SUB, false);
 	set_flag(FLAG_ZERO, false);
 
-	reg_SP = result;
-}
-
-void CPU::INC(Pair reg_pair)
-{
-	reg_pair.set(reg_pair.get() + 1);//  ,    
+	reg.SP = result;
 }
 
-void CPU::INCSP()
+void CPU::INC16(Byte_2& reg_pair)
 {
-	reg_SP++;
+	reg_pair++;//  ,    
 }
 
-void CPU::DEC(Pair reg_pair)
+void CPU::DEC16(Byte_2& reg_pair)
 {
-	reg_pair.set(reg_pair.get() - 1); //  ,    
+	reg_pair--; //  ,    
 }
 
-void CPU::DECSP()
-{
-	reg_SP--;
-}
 
 //    
 //   1  
 void CPU::RL(Byte& target, bool carry, bool zero_flag)
 {
-	int bit7 = ((target & 0x80) != 0);
+	Byte bit7 = ((target & 0x80) != 0);
 	target = target << 1;
 
-	target |= (carry) ? ((reg_F & FLAG_CARRY) != 0) : bit7;
+	target |= (carry) ? carry_flag() : bit7;
 
-	set_flag(FLAG_ZERO, ((zero_flag) ? (target == 0) : false));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_CARRY, (bit7 != 0));
-}
-
-void CPU::RL(Address addr, bool carry)
-{
-	Byte value = memory->read(addr);
-	RL(value, carry, true);
-	memory->write(addr, value);
+	defer_flags(FLAGS_SHIFT, zero_flag, 0, bit7, target);
 }
 
 void CPU::RR(Byte& target, bool carry, bool zero_flag)
 {
-	int bit1 = ((target & 0x1) != 0);
+	Byte bit1 = ((target & 0x1) != 0);
 	target = target >> 1;
 
-	target |= (carry) ? (((reg_F & FLAG_CARRY) != 0) << 7) : (bit1 << 7);
+	target |= (carry) ? (carry_flag() << 7) : (bit1 << 7);
 
-	set_flag(FLAG_ZERO, ((zero_flag) ? (target == 0) : false));
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_CARRY, (bit1 != 0));
-}
-
-void CPU::RR(Address addr, bool carry)
-{
-	Byte value = memory->read(addr);
-	RR(value, carry, true);
-	memory->write(addr, value);
+	defer_flags(FLAGS_SHIFT, zero_flag, 0, bit1, target);
 }
 
 //  
 void CPU::SL(Byte& target)
 {
 	Byte result = target << 1;
-
-	set_flag(FLAG_CARRY, (target & 0x80) != 0);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_ZERO, (result == 0));
-
-	target = result;
-}
-
-void CPU::SL(Address addr)
-{
-	Byte data = memory->read(addr);
-	SL(data);
-	memory->write(addr, data);
-}
-
-//  
-void CPU::SR(Byte& target, bool include_top_bit)
-{
-	bool top_bit_set = is_bit_set(target, BIT_7);
-
-	Byte result;
-
-	if (include_top_bit)
-		result = (top_bit_set) ? ((target >> 1) | 0x80) : (target >> 1);
-	else
-		result = target >> 1;
-
-	set_flag(FLAG_CARRY, (target & 0x01) != 0);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_ZERO, (result == 0));
+	defer_flags(FLAGS_SHIFT, true, 0, (target & 0x80) != 0, result);
 
 	target = result;
 }
 
-void CPU::SR(Address addr, bool include_top_bit)
-{
-	Byte data = memory->read(addr);
-	SR(data, include_top_bit);
-	memory->write(addr, data);
-}
-
-//   ,   ,   7  
-void CPU::SRA(Byte& target)
-{
-	//   7  
-	int bit7 = ((target & 0x80) != 0);
-	RR(target, true);
-	target |= (bit7 << 7);
-	set_flag(FLAG_ZERO, (target == 0));
-}
-
-void CPU::SRA(Address addr)
-{
-	Byte value = memory->read(addr);
-	SRA(value);
-	memory->write(addr, value);
-}
-
-//   ,   ,   7 
-void CPU::SRL(Byte& target)
-{
-	RR(target, true, true);
-}
-
-void CPU::SRL(Address addr)
-{
-	Byte value = memory->read(addr);
-	SRL(value);
-	memory->write(addr, value);
-}
-
 //      
 void CPU::SWAP(Byte& target)
 {
@@ -532,241 +493,285 @@ void CPU::SWAP(Byte& target)
 
 	target = swapped;
 
-	set_flag(FLAG_CARRY, false);
-	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_SUB, false);
-	set_flag(FLAG_ZERO, (target == 0));
-}
-
-void CPU::SWAP(Address addr)
-{
-	Byte value = memory->read(addr);
-	SWAP(value);
-	memory->write(addr, value);
-}
-
-//   
-
-void CPU::BIT(Byte target, int bit)
-{
-	set_flag(FLAG_ZERO, (((1 << bit) & ~target) != 0));
-	set_flag(FLAG_HALF_CARRY, true);
-	set_flag(FLAG_SUB, false);
-}
-
-void CPU::BIT(Address addr, int bit)
-{
-	Byte value = memory->read(addr);
-	BIT(value, bit);
-}
-
-void CPU::SET(Byte& target, int bit)
-{
-	target = (target | (1 << bit));
-}
-
-void CPU::SET(Address addr, int bit)
-{
-	Byte value = memory->read(addr);
-	SET(value, bit);
-	memory->write(addr, value);
-}
-
-void CPU::RES(Byte& target, int bit)
-{
-	target = (~(1 << bit) & target);
-}
-
-void CPU::RES(Address addr, int bit)
-{
-	Byte value = memory->read(addr);
-	RES(value, bit);
-	memory->write(addr, value);
+	defer_flags(FLAGS_SHIFT, true, 0, 0, target);
 }
 
 //  
 //    
 
-void CPU::JP(Pair target)
+void CPU::JP(Address target)
 {
-	reg_PC = target.address();
-	op(0, 1); //  1 ,   
+	// JP and CALL are 3 bytes long, PC is already past them
+	Address jump = reg.PC - 3;
+
+	if (report_loops && target <= jump && jump - target <= 16)
+		loop_back();
+
+	reg.PC = target;
 }
 //    ,   ZERO 
 
-void CPU::JPNZ(Pair target)
+bool CPU::JPNZ(Address target)
 {
-	if ((reg_F & FLAG_ZERO) == 0)
+	if (!zero_flag())
+	{
 		JP(target);
+		return true;
+	}
+
+	return false;
 }
 //    ,   ZERO 
 
-void CPU::JPZ(Pair target)
+bool CPU::JPZ(Address target)
 {
-	if ((reg_F & FLAG_ZERO) != 0)
+	if (zero_flag())
+	{
 		JP(target);
+		return true;
+	}
+
+	return false;
 }
 //    ,   CARRY 
 
-void CPU::JPNC(Pair target)
+bool CPU::JPNC(Address target)
 {
-	if ((reg_F & FLAG_CARRY) == 0)
+	if (!carry_flag())
+	{
 		JP(target);
+		return true;
+	}
+
+	return false;
 }
 //    ,   CARRY 
 
-void CPU::JPC(Pair target)
+bool CPU::JPC(Address target)
 {
-	if ((reg_F & FLAG_CARRY) != 0)
+	if (carry_flag())
+	{
 		JP(target);
+		return true;
+	}
+
+	return false;
 }
 
 //        -127  +129 
 void CPU::JR(Byte value)
 {
 	Byte_Signed signed_val = ((Byte_Signed)(value));
-	reg_PC += signed_val; //     2,    
-	op(0, 1); //  1 ,   
+	reg.PC += signed_val; //     2,    
 
+	// back to at most 16 bytes before the JR itself
+	if (report_loops && signed_val >= -18 && signed_val <= -2)
+		loop_back();
+}
+
+// Leaves the candidate idle loop to Emulator::skip_idle_loop
+void CPU::loop_back()
+{
+	branched_back = true;
+	scheduler->stop();
 }
 //       ,   ZERO 
 
-void CPU::JRNZ(Byte value)
+bool CPU::JRNZ(Byte value)
 {
-	if ((reg_F & FLAG_ZERO) == 0)
+	if (!zero_flag())
+	{
 		JR(value);
+		return true;
+	}
+
+	return false;
 }
 //       ,   ZERO 
 
-void CPU::JRZ(Byte value)
+bool CPU::JRZ(Byte value)
 {
-	if ((reg_F & FLAG_ZERO) != 0)
+	if (zero_flag())
+	{
 		JR(value);
+		return true;
+	}
+
+	return false;
 }
 //       ,   CARRY 
 
-void CPU::JRNC(Byte value)
+bool CPU::JRNC(Byte value)
 {
-	if ((reg_F & FLAG_CARRY) == 0)
+	if (!carry_flag())
+	{
 		JR(value);
+		return true;
+	}
+
+	return false;
 }
 //       ,   CARRY 
 
-void CPU::JRC(Byte value)
+bool CPU::JRC(Byte value)
 {
-	if ((reg_F & FLAG_CARRY) != 0)
+	if (carry_flag())
+	{
 		JR(value);
+		return true;
+	}
+
+	return false;
 }
 //   ,    HL
 
 void CPU::JPHL()
 {
-	reg_PC = Pair(reg_H, reg_L).address();
+	reg.PC = reg.HL;
 }
 //  
 //    
 
-void CPU::CALL(Byte low, Byte high)
+template <class Timing>
+void CPU::CALL(Address target)
 {
-	memory->write(--reg_SP, high_byte(reg_PC));
-	memory->write(--reg_SP, low_byte(reg_PC));
+	write<Timing>(--reg.SP, high_byte(reg.PC));
+	write<Timing>(--reg.SP, low_byte(reg.PC));
 
-	JP(Pair(high, low));
-	op(0, 3);
+	JP(target);
 }
 //     ,   ZERO 
 
-void CPU::CALLNZ(Byte low, Byte high)
+template <class Timing>
+bool CPU::CALLNZ(Address target)
 {
-	if ((reg_F & FLAG_ZERO) == 0)
-		CALL(low, high);
+	if (!zero_flag())
+	{
+		CALL<Timing>(target);
+		return true;
+	}
+
+	return false;
 }
 //     ,   ZERO 
 
-void CPU::CALLZ(Byte low, Byte high)
+template <class Timing>
+bool CPU::CALLZ(Address target)
 {
-	if ((reg_F & FLAG_ZERO) != 0)
-		CALL(low, high);
+	if (zero_flag())
+	{
+		CALL<Timing>(target);
+		return true;
+	}
+
+	return false;
 }
 //     ,   CARRY 
 
-void CPU::CALLNC(Byte low, Byte high)
+template <class Timing>
+bool CPU::CALLNC(Address target)
 {
-	if ((reg_F & FLAG_CARRY) == 0)
-		CALL(low, high);
+	if (!carry_flag())
+	{
+		CALL<Timing>(target);
+		return true;
+	}
+
+	return false;
 }
 //     ,   CARRY 
 
-void CPU::CALLC(Byte low, Byte high)
+template <class Timing>
+bool CPU::CALLC(Address target)
 {
-	if ((reg_F & FLAG_CARRY) != 0)
-		CALL(low, high);
+	if (carry_flag())
+	{
+		CALL<Timing>(target);
+		return true;
+	}
+
+	return false;
 }
 //   
 
+template <class Timing>
 void CPU::RET()
 {
-	Byte low = memory->read(reg_SP++);
-	Byte high = memory->read(reg_SP++);
+	Byte low = read<Timing>(reg.SP++);
+	Byte high = read<Timing>(reg.SP++);
 
-	reg_PC = Pair(high, low).get();
-	op(0, 3);
+	reg.PC = combine(high, low);
 }
 //       
 
+template <class Timing>
 void CPU::RETI()
 {
 	interrupt_master_enable = true;
-	RET();
+	scheduler->request_sync();
+	RET<Timing>();
 }
 //    ,   ZERO 
 
-void CPU::RETNZ()
+template <class Timing>
+bool CPU::RETNZ()
 {
-	if ((reg_F & FLAG_ZERO) == 0)
+	if (!zero_flag())
 	{
-		RET();
-		op(0, 2);
+		RET<Timing>();
+		return true;
 	}
+
+	return false;
 }
 //    ,   ZERO 
 
-void CPU::RETZ()
+template <class Timing>
+bool CPU::RETZ()
 {
-	if ((reg_F & FLAG_ZERO) != 0)
+	if (zero_flag())
 	{
-		RET();
-		op(0, 2);
+		RET<Timing>();
+		return true;
 	}
+
+	return false;
 }
 //    ,   CARRY 
 
-void CPU::RETNC()
+template <class Timing>
+bool CPU::RETNC()
 {
-	if ((reg_F & FLAG_CARRY) == 0)
+	if (!carry_flag())
 	{
-		RET();
-		op(0, 2);
+		RET<Timing>();
+		return true;
 	}
+
+	return false;
 }
 //    ,   CARRY 
 
-void CPU::RETC()
+template <class Timing>
+bool CPU::RETC()
 {
-	if ((reg_F & FLAG_CARRY) != 0)
+	if (carry_flag())
 	{
-		RET();
-		op(0, 2);
+		RET<Timing>();
+		return true;
 	}
+
+	return false;
 }
 //       
 
+template <class Timing>
 void CPU::RST(Address addr)
 {
-	memory->write(--reg_SP, high_byte(reg_PC));
-	memory->write(--reg_SP, low_byte(reg_PC));
+	write<Timing>(--reg.SP, high_byte(reg.PC));
+	write<Timing>(--reg.SP, low_byte(reg.PC));
 
-	reg_PC = addr;
+	reg.PC = addr;
 }
 //   
 // Decimal Adjust Accumulator
@@ -776,14 +781,14 @@ void CPU::RST(Address addr)
 // will come back and try to understand this fully
 void CPU::DAA()
 {
-	Byte high = high_nibble(reg_A);
-	Byte low = low_nibble(reg_A);
+	Byte high = high_nibble(reg.A);
+	Byte low = low_nibble(reg.A);
 
-	bool add = ((reg_F & FLAG_SUB) == 0);
-	bool carry = ((reg_F & FLAG_CARRY) != 0);
-	bool half_carry = ((reg_F & FLAG_HALF_CARRY) != 0);
+	bool add = ((flags() & FLAG_SUB) == 0);
+	bool carry = ((flags() & FLAG_CARRY) != 0);
+	bool half_carry = ((flags() & FLAG_HALF_CARRY) != 0);
 
-	Byte_2 result = (Byte_2) reg_A;
+	Byte_2 result = (Byte_2) reg.A;
 	Byte_2 correction = (carry) ? 0x60 : 0x00;
 
 	if (half_carry || (add) && ((result & 0x0F) > 9))
@@ -801,14 +806,14 @@ void CPU::DAA()
 		set_flag(FLAG_CARRY, true);
 
 	set_flag(FLAG_HALF_CARRY, false);
-	reg_A = (Byte)(result & 0xFF);
-	set_flag(FLAG_ZERO, reg_A == 0);
+	reg.A = (Byte)(result & 0xFF);
+	set_flag(FLAG_ZERO, reg.A == 0);
 }
 //    
 
 void CPU::CPL()
 {
-	reg_A = ~reg_A;
+	reg.A = ~reg.A;
 	set_flag(FLAG_HALF_CARRY, true);
 	set_flag(FLAG_SUB, true);
 }
@@ -826,7 +831,7 @@ void CPU::CCF()
 {
 	set_flag(FLAG_SUB, false);
 	set_flag(FLAG_HALF_CARRY, false);
-	set_flag(FLAG_CARRY, ((reg_F & FLAG_CARRY) ? 1 : 0) ^ 1);
+	set_flag(FLAG_CARRY, !carry_flag());
 }
 //  
 
@@ -848,6 +853,7 @@ void CPU::HALT()
 	//   
 
 	halted = true;
+	scheduler->request_sync();
 	op(-1, 0); //  ,   HALT  
 
 	// ,    
@@ -865,16 +871,49 @@ void CPU::STOP()
 void CPU::DI()
 {
 	interrupt_master_enable = false;
+	interrupt_enable_delay = 0;
 }
 //   
 
 void CPU::EI()
 {
-	interrupt_master_enable = true;
+	// counted down by the syncs after EI and after the next instruction
+	interrupt_enable_delay = 2;
+	scheduler->request_sync();
 }
 // 
 
+// Prints the instruction at PC and the registers
 void CPU::debug()
 {
-	parse_opcode(0xE8);
-}
+	char line[96];
+	flags();
+	snprintf(line, sizeof(line), "%04X  %-16s AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X",
+		reg.PC, disassemble(reg.PC).c_str(), reg.AF, reg.BC, reg.DE, reg.HL, reg.SP);
+
+	cout << line << endl;
+}
+
+// The memory accessing helpers are used by the handlers in opcodes.cpp with either accuracy policy
+#define INSTANTIATE_TIMING(Timing) \
+	template void CPU::step<Timing>(); \
+	template void CPU::LDNN<Timing>(Address); \
+	template void CPU::PUSH<Timing>(Byte_2); \
+	template void CPU::POP<Timing>(Byte_2&); \
+	template void CPU::CALL<Timing>(Address); \
+	template bool CPU::CALLNZ<Timing>(Address); \
+	template bool CPU::CALLZ<Timing>(Address); \
+	template bool CPU::CALLNC<Timing>(Address); \
+	template bool CPU::CALLC<Timing>(Address); \
+	template void CPU::RET<Timing>(); \
+	template void CPU::RETI<Timing>(); \
+	template bool CPU::RETNZ<Timing>(); \
+	template bool CPU::RETZ<Timing>(); \
+	template bool CPU::RETNC<Timing>(); \
+	template bool CPU::RETC<Timing>(); \
+	template void CPU::RST<Timing>(Address);
+
+INSTANTIATE_TIMING(FastTiming)
+INSTANTIATE_TIMING(AccurateTiming)
+
+#undef INSTANTIATE_TIMING
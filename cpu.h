@@ -2,38 +2,116 @@
 
 #include "types.h"
 #include "memory.h"
+#include "scheduler.h"
+#include "jit.h"
+#include "opcode_table.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(high, low) union { Byte_2 high##low; struct { Byte high, low; }; }
+#else
+#define REGISTER_PAIR(high, low) union { Byte_2 high##low; struct { Byte low, high; }; }
+#endif
+
+// Flags are evaluated lazily unless built with LAZY_FLAGS=0 (see CPU::flags)
+#ifndef LAZY_FLAGS
+#define LAZY_FLAGS 1
+#endif
+
+// Register file, every pair can be used as one 16-bit register or as two 8-bit registers
+struct Registers
+{
+	REGISTER_PAIR(A, F); // Аккумулятор, Ðåãèñòð ôëàãîâ
+	REGISTER_PAIR(B, C);
+	REGISTER_PAIR(D, E);
+	REGISTER_PAIR(H, L);
+	Byte_2 SP; // Стек
+	Byte_2 PC; // Счетчик команд
+};
 
+/*
+	Accuracy policies the instruction handlers are instantiated with, picked per run.
+	FastTiming hands an instruction's cycles to timers and LCD in one go once it has
+	executed. AccurateTiming advances them by an M-cycle before every memory access the
+	instruction makes (see CPU::memory_cycle), so reads and writes see timers and LCD as
+	they are at that cycle.
+*/
+struct FastTiming { static constexpr bool per_access = false; };
+struct AccurateTiming { static constexpr bool per_access = true; };
 
 class CPU
 {
 public:
-	Byte reg_A; // Аккумулятор
-	Byte reg_B;
-	Byte reg_C;
-	Byte reg_D;
-	Byte reg_E;
-	Byte reg_H;
-	Byte reg_L;
-	Byte reg_F; // Ðåãèñòð ôëàãîâ
-	Byte_2 reg_SP; // Стек
-	Byte_2 reg_PC; // Счетчик команд
+	Registers reg;
 
 	int CLOCK_SPEED = 4194304; // Макс частота процессора 
 	int num_cycles = 0;
+	unsigned long long memory_reads = 0; // Memory reads made by instructions, including operand fetches
 	bool interrupt_master_enable = true;
+	int interrupt_enable_delay = 0; // EI sets IME once the instruction after it has run (see Emulator::do_interrupts)
 	bool halted = false;
 
+	// Short backward jumps and calls (at most 16 bytes back) set branched_back and end the
+	// run at the next instruction, so the emulator can look for an idle loop there
+	bool report_loops = false;
+	bool branched_back = false;
+
+	// Cached interpreter, runs pre-decoded ROM blocks instead of single instructions
+	bool use_block_cache = false;
+	unsigned long long blocks_decoded = 0;
+
+	// Runs hot blocks as call-threaded native code (jit.cpp), needs use_block_cache
+	bool use_jit = false;
+	unsigned long long blocks_compiled = 0;
+
+	// Instruction sequences the block decoder fuses into one handler
+	enum FusionIdiom
+	{
+		FUSE_COPY,      // LD A,(HL+); LD (DE),A; INC DE; DEC BC
+		FUSE_COUNTER,   // DEC r; JR NZ
+		FUSE_POLL,      // LDH A,(n); CP n; JR cc
+		FUSE_LOOP_TEST, // LD A,B; OR C; JR NZ
+		FUSION_IDIOMS
+	};
+
+	static const char* const fusion_names[FUSION_IDIOMS];
+
+	bool use_fusion = true;
+	unsigned long long fusion_hits[FUSION_IDIOMS] = {};
+
+	// Opcode counts by OPCODE_TABLE index, only kept by step()
+	bool profile = false;
+	unsigned long long opcode_counts[512] = {};
+
+	// AccurateTiming: called with the cycles that pass before each memory access,
+	// access_cycles adds them up over the current instruction
+	function<void(int cycles)> on_memory_cycle;
+	int access_cycles = 0;
+
 	void save_state(ofstream& file);
 	void load_state(ifstream& file);
 
-	void init(Memory* _memory);
+	void init(Memory* _memory, Scheduler* _scheduler);
 	void reset();
-	void parse_opcode(Opcode code);
+	template <class Timing = FastTiming> void step();
+	int run_block();
+	template <class Timing = FastTiming> void parse_opcode(Opcode code);
+	bool is_polling_loop(Address location);
+	string disassemble(Address location);
+	Registers get_registers();
 	void debug();
 
+	// Self checks (cpu_tests.cpp), true when everything matched
+	bool test_flags();
+	bool test_timing();
+
 private:
 
 	Memory* memory;
+	Scheduler* scheduler;
+
+	void loop_back();
+
+	template <class Timing> int check_timing(const char* timing, long long& checked);
 
 	const int
 		FLAG_ZERO = 0b10000000,
@@ -41,132 +119,263 @@ private:
 		FLAG_HALF_CARRY = 0b00100000,
 		FLAG_CARRY = 0b00010000;
 
+	// Opcode dispatch tables, one handler per opcode (see opcodes.cpp).
+	// The block cache and the JIT only use the FastTiming ones
+	typedef void (CPU::*Instruction)();
+	static const array<Instruction, 256> instructions;
+	static const array<Instruction, 256> bit_instructions;
+	static const array<Instruction, 256> accurate_instructions;
+	static const array<Instruction, 256> accurate_bit_instructions;
+
+	template <class Timing, size_t... codes>
+	static constexpr array<Instruction, 256> make_table(index_sequence<codes...>);
+	template <class Timing, size_t... codes>
+	static constexpr array<Instruction, 256> make_bit_table(index_sequence<codes...>);
+
+	template <class Timing, Opcode code> void instruction();
+	template <class Timing, Opcode code> void bit_instruction();
+
+	// CB opcodes are decoded at compile time into operation (bits 7-6), bit index or
+	// rotate/shift kind (bits 5-3) and target (bits 2-0: B, C, D, E, H, L, (HL), A)
+	enum BitOperation { CB_SHIFT, CB_BIT, CB_RES, CB_SET };
+
+	template <int operation, int bit> void bit_operation(Byte& value);
+	template <int target> Byte& bit_target();
+
+	Byte read(Address location);
+	void write(Address location, Byte data);
+	Byte imm8();
+	Address imm16();
+
+	// Memory accesses made by the handlers, each one an M-cycle under AccurateTiming
+	template <class Timing> void memory_cycle()
+	{
+		if (Timing::per_access)
+		{
+			access_cycles += 4;
+			on_memory_cycle(4);
+		}
+	}
+
+	template <class Timing> Byte read(Address location)
+	{
+		memory_cycle<Timing>();
+		return read(location);
+	}
+
+	template <class Timing> void write(Address location, Byte data)
+	{
+		memory_cycle<Timing>();
+		write(location, data);
+	}
+
+	template <class Timing> Byte imm8()
+	{
+		memory_cycle<Timing>();
+		return imm8();
+	}
+
+	template <class Timing> Address imm16()
+	{
+		memory_cycle<Timing>();
+		memory_cycle<Timing>();
+		return imm16();
+	}
+
+	// ---------- Cached interpreter (block_cache.cpp) ---------- //
+
+	static const int MAX_FUSED = 4;
+
+	// A decoded instruction: its handler and the operand bytes that followed the opcode.
+	// A fused idiom keeps the operands of each of its instructions, in order.
+	struct MicroOp
+	{
+		Instruction handler;
+		Byte_2 operands[MAX_FUSED];
+		Opcode code;
+		Byte length; // instructions covered, more than 1 for fused idioms
+		Byte cycles; // clocks with a branch taken, the longest it can run
+	};
+
+	struct FusionPattern
+	{
+		FusionIdiom idiom;
+		vector<Opcode> codes;
+		Instruction handler;
+	};
+
+	static const vector<FusionPattern> fusion_patterns;
+
+	template <FusionIdiom idiom, Opcode... codes> void fused_instruction();
+
+	// Call-threaded code for a block, returns the number of instructions executed
+	typedef int (*CompiledBlock)(CPU* cpu);
+
+	// Straight-line run of ROM instructions, ended by a branch or anything touching interrupt state
+	struct BasicBlock
+	{
+		vector<MicroOp> ops;
+		bool touches_io = false; // addresses $FF00 - $FFFF directly, never compiled
+		int cycles = 0; // sum of the micro ops' cycles
+		int executions = 0;
+		CompiledBlock compiled = nullptr;
+	};
+
+	static const int MAX_BLOCK_LENGTH = 64;
+	static const int JIT_THRESHOLD = 32; // executions before a block is compiled
+
+	// Decoded blocks per ROM bank, indexed by address within the 16kB bank window.
+	// Bank 0 holds $0000 - $3FFF, other banks are keyed by the bank mapped at $4000 - $7FFF.
+	vector<vector<unique_ptr<BasicBlock>>> block_cache;
+
+	bool executing_block = false;
+	const Byte_2* block_operands = nullptr;
+
+	BasicBlock* find_block(Address location);
+	unique_ptr<BasicBlock> decode_block(Address location);
+	static bool ends_block(Opcode code);
+
+	void fuse(vector<MicroOp>& ops);
+
+	// ---------- Call-threaded code (jit.cpp) ---------- //
+
+	CodeBuffer code_buffer;
+
+	CompiledBlock compile_block(const BasicBlock* block);
+	bool compile_instruction(Opcode code, Byte_2 operand);
+	void emit_pending(int& pending_pc, int& pending_cycles);
+	void emit_field(Byte opcode, Byte extension, const void* field);
+	void emit_return(int executed);
+	static bool call_handler(CPU* cpu, const MicroOp* micro_op);
+
 	void op(int pc, int cycle);
-	void parse_bit_op(Opcode code);
+
+	// Advances PC and the cycle count by the OPCODE_TABLE entry (CB prefixed ones at CB_PREFIXED + code)
+	template <int index> void op()
+	{
+		constexpr int length = OPCODE_TABLE[index].length;
+		constexpr int cycles = OPCODE_TABLE[index].cycles;
+		op(length, cycles);
+	}
+
+	// Adds the extra cycles of a conditional jump, call or return that was taken
+	template <int index> void taken()
+	{
+		constexpr int extra = OPCODE_TABLE[index].taken_cycles - OPCODE_TABLE[index].cycles;
+		op(0, extra);
+	}
+	template <class Timing> void parse_bit_op(Opcode code);
 	void set_flag(int flag, bool value);
 
+	// Lazy flags: the last flag-setting operation, materialized into reg.F on demand
+	enum FlagOperation : Byte
+	{
+		FLAGS_NONE, // reg.F is up to date
+		FLAGS_ADD,
+		FLAGS_SUB,
+		FLAGS_INC,
+		FLAGS_DEC,
+		FLAGS_AND,
+		FLAGS_OR,
+		FLAGS_SHIFT
+	};
+
+	struct LazyFlags
+	{
+		FlagOperation operation = FLAGS_NONE;
+		Byte a = 0, b = 0, carry = 0, result = 0;
+	} lazy_flags;
+
+	void defer_flags(FlagOperation operation, Byte a, Byte b, Byte carry, Byte result);
+	Byte flags();
+	bool zero_flag();
+	bool carry_flag();
+	void load_flags(Byte value);
+
 	// ---------- Ассемблерные команды ---------- //
 
 	// Операции загрузки значения
 	void LD(Byte& destination, Byte value);
-	void LD(Byte& destination, Address addr);
-	void LD(Address addr, Byte value);
 
 	// Çàãðóçêè 16-áèòíûõ çíà÷åíèé
-	void LD(Pair reg_pair, Byte upper, Byte lower);
-	void LD(Byte_2& reg_pair, Byte upper, Byte lower);
+	void LD16(Byte_2& reg_pair, Byte_2 value);
 	void LDHL(Byte value);
-	void LDNN(Byte low, Byte high);
+	template <class Timing> void LDNN(Address addr);
 
-	void PUSH(Byte high, Byte low);
-	void POP(Byte& high, Byte& low);
+	template <class Timing> void PUSH(Byte_2 reg_pair);
+	template <class Timing> void POP(Byte_2& reg_pair);
 
 	void ADD(Byte& target, Byte value);
-	void ADD(Byte& target, Address addr);
 	void ADC(Byte& target, Byte value);
-	void ADC(Byte& target, Address addr);
 
 	void SUB(Byte& target, Byte value);
-	void SUB(Byte& target, Address addr);
 	void SBC(Byte& target, Byte value);
-	void SBC(Byte& target, Address addr);
 
 	void AND(Byte& target, Byte value);
-	void AND(Byte& target, Address addr);
 
 	void OR(Byte& target, Byte value);
-	void OR(Byte& target, Address addr);
 
 	void XOR(Byte& target, Byte value);
-	void XOR(Byte& target, Address addr);
 
 	void CP(Byte& target, Byte value);
-	void CP(Byte& target, Address addr);
 
 	void INC(Byte& target);
-	void INC(Address addr);
 
 	void DEC(Byte& target);
-	void DEC(Address addr);
 
 	// Àðèôìåòèêà 16-áèòíûõ çíà÷åíèé
 	void ADD16(Byte_2 target, Byte_2 value);
-	void ADDHL(Pair reg_pair);
-	void ADDHLSP();
+	void ADDHL(Byte_2 value);
 	void ADDSP(Byte value);
 
-	void INC(Pair reg_pair);
-	void INCSP();
-	void DEC(Pair reg_pair);
-	void DECSP();
+	void INC16(Byte_2& reg_pair);
+	void DEC16(Byte_2& reg_pair);
 
 	// Èíñòðóêöèè ñäâèãà è âðàùåíèÿ
 
 	// Ñäâèã âëåâî
 	void SL(Byte& target);
-	void SL(Address addr);
-
-	// Ñäâèã âïðàâî
-	void SR(Byte& target, bool include_top_bit);
-	void SR(Address addr, bool include_top_bit);
 
 	// Ñäâèãè ÷åðåç ïåðåíîñ
 	void RL(Byte& target, bool carry, bool zero_flag = false);
-	void RL(Address addr, bool carry);
 	void RR(Byte& target, bool carry, bool zero_flag = false);
-	void RR(Address addr, bool carry);
-
-	void SRA(Byte& target);
-	void SRA(Address addr);
-	void SRL(Byte& target);
-	void SRL(Address addr);
 
 	void SWAP(Byte& target);
-	void SWAP(Address addr);
-
-	// Îïåðàöèè íàä áèòàìè
-	void BIT(Byte target, int bit);
-	void BIT(Address addr, int bit);
-
-	void SET(Byte& target, int bit);
-	void SET(Address addr, int bit);
-
-	void RES(Byte& target, int bit);
-	void RES(Address addr, int bit);
 
 	void SCF();
 	void CCF();
 
 	// Операции перехода.
-	void JP(Pair target);
-	void JPNZ(Pair target);
-	void JPZ(Pair target);
-	void JPNC(Pair target);
-	void JPC(Pair target);
+	// Conditional jumps, calls and returns tell whether they were taken, for taken<code>()
+	void JP(Address target);
+	bool JPNZ(Address target);
+	bool JPZ(Address target);
+	bool JPNC(Address target);
+	bool JPC(Address target);
 	void JR(Byte value);
 
-	void JRNZ(Byte value);
-	void JRZ(Byte value);
-	void JRNC(Byte value);
-	void JRC(Byte value);
+	bool JRNZ(Byte value);
+	bool JRZ(Byte value);
+	bool JRNC(Byte value);
+	bool JRC(Byte value);
 	void JPHL();
 
 	// Ôóíêöèîíàëüíûå èíñòðóêöèè
-	void CALL(Byte low, Byte high);
-	void CALLNZ(Byte low, Byte high);
-	void CALLZ(Byte low, Byte high);
-	void CALLNC(Byte low, Byte high);
-	void CALLC(Byte low, Byte high);
-
-	void RET();
-	void RETI(); // ÍÅ ÐÅÀËÈÇÎÂÀÍÎ
-	void RETNZ();
-	void RETZ();
-	void RETNC();
-	void RETC();
+	template <class Timing> void CALL(Address target);
+	template <class Timing> bool CALLNZ(Address target);
+	template <class Timing> bool CALLZ(Address target);
+	template <class Timing> bool CALLNC(Address target);
+	template <class Timing> bool CALLC(Address target);
+
+	template <class Timing> void RET();
+	template <class Timing> void RETI(); // ÍÅ ÐÅÀËÈÇÎÂÀÍÎ
+	template <class Timing> bool RETNZ();
+	template <class Timing> bool RETZ();
+	template <class Timing> bool RETNC();
+	template <class Timing> bool RETC();
 
 	// Ðàçëè÷íûå èíñòðóêöèè
-	void RST(Address addr);
+	template <class Timing> void RST(Address addr);
 
 	void DAA();
 	void CPL();
@@ -0,0 +1,294 @@
+#include "cpu.h"
+
+/*
+	Self checks of the CPU, run from the command line (see main.cpp). They need no ROM,
+	instructions run on registers and WRAM.
+*/
+
+namespace
+{
+	// Bits of the flag register, for the reference results
+	const Byte ZERO = 0x80, SUB = 0x40, HALF_CARRY = 0x20, CARRY = 0x10;
+
+	enum FlagKind
+	{
+		KIND_ADD, KIND_ADC, KIND_SUB, KIND_SBC, KIND_AND, KIND_XOR, KIND_OR, KIND_CP, // A with B
+		KIND_INC, KIND_DEC,                                                           // B
+		KIND_RLCA, KIND_RRCA, KIND_RLA, KIND_RRA,                                     // A
+		KIND_RLC, KIND_RRC, KIND_RL, KIND_RR, KIND_SLA, KIND_SRA, KIND_SWAP, KIND_SRL  // B
+	};
+
+	// Every instruction kind that defers its flags, by OPCODE_TABLE index
+	const struct { FlagKind kind; int index; } FLAG_CASES[] =
+	{
+		{ KIND_ADD, 0x80 }, { KIND_ADC, 0x88 }, { KIND_SUB, 0x90 }, { KIND_SBC, 0x98 },
+		{ KIND_AND, 0xA0 }, { KIND_XOR, 0xA8 }, { KIND_OR, 0xB0 }, { KIND_CP, 0xB8 },
+		{ KIND_INC, 0x04 }, { KIND_DEC, 0x05 },
+		{ KIND_RLCA, 0x07 }, { KIND_RRCA, 0x0F }, { KIND_RLA, 0x17 }, { KIND_RRA, 0x1F },
+		{ KIND_RLC, CB_PREFIXED + 0x00 }, { KIND_RRC, CB_PREFIXED + 0x08 },
+		{ KIND_RL, CB_PREFIXED + 0x10 }, { KIND_RR, CB_PREFIXED + 0x18 },
+		{ KIND_SLA, CB_PREFIXED + 0x20 }, { KIND_SRA, CB_PREFIXED + 0x28 },
+		{ KIND_SWAP, CB_PREFIXED + 0x30 }, { KIND_SRL, CB_PREFIXED + 0x38 }
+	};
+
+	// Result and flag register of an instruction, set eagerly from its operands
+	void eager_flags(FlagKind kind, Byte a, Byte b, int carry, Byte& value, Byte& flags)
+	{
+		int result = 0;
+		flags = 0;
+
+		switch (kind)
+		{
+			case KIND_ADD:
+				carry = 0; // fall through
+			case KIND_ADC:
+				result = a + b + carry;
+				flags = (((a & 0xF) + (b & 0xF) + carry > 0xF) ? HALF_CARRY : 0) | ((result > 0xFF) ? CARRY : 0);
+				break;
+			case KIND_SUB:
+			case KIND_CP:
+				carry = 0; // fall through
+			case KIND_SBC:
+				result = a - b - carry;
+				flags = SUB | (((a & 0xF) - (b & 0xF) - carry < 0) ? HALF_CARRY : 0) | ((result < 0) ? CARRY : 0);
+				break;
+			case KIND_AND: result = a & b; flags = HALF_CARRY; break;
+			case KIND_XOR: result = a ^ b; break;
+			case KIND_OR: result = a | b; break;
+			case KIND_INC:
+				result = a + 1;
+				flags = (((a & 0xF) == 0xF) ? HALF_CARRY : 0) | (carry ? CARRY : 0);
+				break;
+			case KIND_DEC:
+				result = a - 1;
+				flags = SUB | (((a & 0xF) == 0) ? HALF_CARRY : 0) | (carry ? CARRY : 0);
+				break;
+			case KIND_RLCA:
+			case KIND_RLC: result = (a << 1) | (a >> 7); flags = (a & 0x80) ? CARRY : 0; break;
+			case KIND_RLA:
+			case KIND_RL: result = (a << 1) | carry; flags = (a & 0x80) ? CARRY : 0; break;
+			case KIND_RRCA:
+			case KIND_RRC: result = (a >> 1) | (a << 7); flags = (a & 0x01) ? CARRY : 0; break;
+			case KIND_RRA:
+			case KIND_RR: result = (a >> 1) | (carry << 7); flags = (a & 0x01) ? CARRY : 0; break;
+			case KIND_SLA: result = a << 1; flags = (a & 0x80) ? CARRY : 0; break;
+			case KIND_SRA: result = (a >> 1) | (a & 0x80); flags = (a & 0x01) ? CARRY : 0; break;
+			case KIND_SWAP: result = (a >> 4) | (a << 4); break;
+			case KIND_SRL: result = a >> 1; flags = (a & 0x01) ? CARRY : 0; break;
+		}
+
+		// CP only compares, and the rotates of A always clear Z
+		bool rotates_a = kind >= KIND_RLCA && kind <= KIND_RRA;
+		value = (kind == KIND_CP) ? a : (Byte)result;
+
+		if ((Byte)result == 0 && !rotates_a)
+			flags |= ZERO;
+	}
+
+	// Where test_timing places the instruction, its operand bytes and what registers point at,
+	// all in WRAM (a8 and (C) land in HRAM)
+	const Address PROGRAM = 0xC000;
+	const Byte OPERAND_LOW = 0x80, OPERAND_HIGH = 0xD2; // d8 / a8 / r8 $80, d16 / a16 $D280
+	const Address RETURN_ADDRESS = 0xD100, STACK = 0xD000;
+	const Address BC = 0xD481, DE = 0xD500, HL = 0xD300;
+
+	// Condition of a conditional jump, call or return (0 NZ, 1 Z, 2 NC, 3 C), -1 for everything else
+	int branch_condition(Opcode code)
+	{
+		// JR cc, RET cc, JP cc and CALL cc
+		bool conditional = (code & 0xE7) == 0x20 || (code & 0xE7) == 0xC0 || (code & 0xE7) == 0xC2 || (code & 0xE7) == 0xC4;
+		return conditional ? (code >> 3) & 3 : -1;
+	}
+
+	// Where a jump, call, return or restart at PROGRAM goes when taken, false for other instructions
+	bool branch_target(Opcode code, Address& target)
+	{
+		switch (code)
+		{
+			case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP
+			case 0xCD: case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL
+				target = combine(OPERAND_HIGH, OPERAND_LOW);
+				return true;
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+				target = PROGRAM + 2 + (Byte_Signed)OPERAND_LOW;
+				return true;
+			case 0xC9: case 0xD9: case 0xC0: case 0xC8: case 0xD0: case 0xD8: // RET
+				target = RETURN_ADDRESS;
+				return true;
+			case 0xE9: // JP (HL)
+				target = HL;
+				return true;
+			default:
+				if ((code & 0xC7) != 0xC7) // RST
+					return false;
+
+				target = code & 0x38;
+				return true;
+		}
+	}
+}
+
+/*
+	Cross-checks the lazy flags against eager_flags: every instruction that defers its flags
+	runs over all 8-bit operands and both carry inputs, with the carry coming either from
+	reg.F or from a still pending ADD. zero_flag() and carry_flag() are compared before
+	flags() materializes the register, then flags() itself.
+*/
+bool CPU::test_flags()
+{
+	long long checked = 0;
+	int failures = 0;
+
+	for (const auto& test : FLAG_CASES)
+	{
+		bool binary = test.kind <= KIND_CP;
+		bool on_a = binary || (test.kind >= KIND_RLCA && test.kind <= KIND_RRA);
+		Instruction handler = (test.index >= CB_PREFIXED) ? bit_instructions[test.index - CB_PREFIXED] : instructions[test.index];
+
+		for (int a = 0; a < 256; a++)
+		{
+			for (int b = 0; b < (binary ? 256 : 1); b++)
+			{
+				for (int carry = 0; carry < 2; carry++)
+				{
+					for (int pending = 0; pending < 2; pending++)
+					{
+						if (pending)
+						{
+							// $FF + carry leaves exactly the carry flag behind
+							Byte scratch = 0xFF;
+							ADD(scratch, carry);
+						}
+						else
+							load_flags(carry ? (FLAG_ZERO | FLAG_CARRY) : (FLAG_SUB | FLAG_HALF_CARRY));
+
+						reg.A = on_a ? a : 0;
+						reg.B = on_a ? b : a;
+						reg.PC = 0;
+						num_cycles = 0;
+
+						(this->*handler)();
+
+						Byte value, expected;
+						eager_flags(test.kind, a, b, carry, value, expected);
+
+						Byte result = on_a ? reg.A : reg.B;
+						bool zero = zero_flag();
+						bool carry_out = carry_flag();
+						Byte materialized = flags();
+						checked++;
+
+						if (result == value && materialized == expected &&
+							zero == ((expected & ZERO) != 0) && carry_out == ((expected & CARRY) != 0))
+							continue;
+
+						if (failures++ < 16)
+						{
+							printf("%s: a=$%02X b=$%02X carry=%d%s -> $%02X F=$%02X Z=%d C=%d, expected $%02X F=$%02X\n",
+								OPCODE_TABLE[test.index].mnemonic, a, b, carry, pending ? " (pending)" : "",
+								result, materialized, zero, carry_out, value, expected);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	cout << "Lazy flags: " << checked << " cases, " << failures << " mismatches" << endl;
+
+	return failures == 0;
+}
+
+/*
+	Runs every opcode, and every CB prefixed one, once with all flags clear and once with all
+	flags set, so conditional jumps, calls and returns go both ways. num_cycles and the new PC
+	must match the OPCODE_TABLE entry: cycles and length when the branch isn't taken,
+	taken_cycles and the branch target when it is. Under AccurateTiming the memory accesses
+	must also fit in the instruction's cycles.
+*/
+template <class Timing>
+int CPU::check_timing(const char* timing, long long& checked)
+{
+	int failures = 0;
+
+	for (int index = 0; index < 512; index++)
+	{
+		Opcode code = (index >= CB_PREFIXED) ? 0xCB : index;
+
+		// the prefix itself only dispatches, its instructions are checked at CB_PREFIXED + code
+		if (index == 0xCB)
+			continue;
+
+		for (int taken_flags = 0; taken_flags < 2; taken_flags++)
+		{
+			Byte flag_register = taken_flags ? 0xF0 : 0x00;
+
+			memory->write(PROGRAM, code);
+			memory->write(PROGRAM + 1, (index >= CB_PREFIXED) ? (Byte)index : OPERAND_LOW);
+			memory->write(PROGRAM + 2, OPERAND_HIGH);
+			memory->write(STACK, low_byte(RETURN_ADDRESS));
+			memory->write(STACK + 1, high_byte(RETURN_ADDRESS));
+
+			reg.A = 0;
+			reg.BC = BC;
+			reg.DE = DE;
+			reg.HL = HL;
+			reg.SP = STACK;
+			reg.PC = PROGRAM;
+			load_flags(flag_register);
+			num_cycles = 0;
+			access_cycles = 0;
+
+			step<Timing>();
+
+			const OpcodeInfo& info = OPCODE_TABLE[index];
+			int condition = (index < CB_PREFIXED) ? branch_condition(code) : -1;
+			Byte condition_flag = (condition & 2) ? FLAG_CARRY : FLAG_ZERO;
+			bool taken = condition >= 0 && ((flag_register & condition_flag) != 0) == ((condition & 1) != 0);
+
+			Address target;
+			bool jumps = index < CB_PREFIXED && branch_target(code, target) && (condition < 0 || taken);
+			Address expected_pc = jumps ? target : (Address)(PROGRAM + info.length);
+
+			// HALT stays on itself until an interrupt (see CPU::HALT)
+			if (index == 0x76)
+				expected_pc = PROGRAM;
+
+			int expected_cycles = 4 * (taken ? info.taken_cycles : info.cycles);
+			checked++;
+
+			if (reg.PC == expected_pc && num_cycles == expected_cycles && access_cycles <= num_cycles)
+				continue;
+
+			if (failures++ < 16)
+			{
+				printf("%s %s, flags $%02X: PC=$%04X, %d cycles (%d in memory accesses), expected PC=$%04X, %d cycles\n",
+					timing, info.mnemonic, flag_register, reg.PC, num_cycles, access_cycles, expected_pc, expected_cycles);
+			}
+		}
+	}
+
+	halted = false;
+	interrupt_master_enable = true;
+	interrupt_enable_delay = 0;
+	num_cycles = 0;
+	access_cycles = 0;
+
+	return failures;
+}
+
+bool CPU::test_timing()
+{
+	long long checked = 0;
+
+	// the accesses only need counting here, not advancing timers and LCD
+	function<void(int cycles)> memory_cycle = on_memory_cycle;
+	on_memory_cycle = [](int) {};
+
+	int failures = check_timing<FastTiming>("FastTiming", checked) + check_timing<AccurateTiming>("AccurateTiming", checked);
+	on_memory_cycle = memory_cycle;
+
+	cout << "Opcode timing: " << checked << " cases, " << failures << " mismatches" << endl;
+
+	return failures == 0;
+}
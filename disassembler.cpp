@@ -0,0 +1,58 @@
+#include "cpu.h"
+
+// Formats the instruction at location from its OPCODE_TABLE entry, e.g. "LDH A,($FF44)" or "JR NZ,$0150"
+string CPU::disassemble(Address location)
+{
+	Opcode code = memory->fetch(location);
+	Byte low = memory->fetch(location + 1);
+	Byte_2 word = combine(memory->fetch(location + 2), low);
+
+	const OpcodeInfo* info = &OPCODE_TABLE[code];
+
+	if (info->operand == OPERAND_CB)
+		info = &OPCODE_TABLE[CB_PREFIXED + low];
+
+	string text = info->mnemonic;
+	const char* placeholder = nullptr;
+	char operand[8];
+
+	switch (info->operand)
+	{
+		case OPERAND_D8:
+			placeholder = "d8";
+			snprintf(operand, sizeof(operand), "$%02X", low);
+			break;
+		case OPERAND_D16:
+			placeholder = "d16";
+			snprintf(operand, sizeof(operand), "$%04X", word);
+			break;
+		case OPERAND_A8:
+			placeholder = "a8";
+			snprintf(operand, sizeof(operand), "$FF%02X", low);
+			break;
+		case OPERAND_A16:
+			placeholder = "a16";
+			snprintf(operand, sizeof(operand), "$%04X", word);
+			break;
+		case OPERAND_R8:
+			// relative jumps show their target, SP offsets their signed value
+			if (code == 0xE8 || code == 0xF8)
+			{
+				placeholder = (code == 0xF8) ? "+r8" : "r8";
+				snprintf(operand, sizeof(operand), "%+d", (Byte_Signed)low);
+			}
+			else
+			{
+				placeholder = "r8";
+				snprintf(operand, sizeof(operand), "$%04X", (Address)(location + 2 + (Byte_Signed)low));
+			}
+			break;
+		default:
+			break;
+	}
+
+	if (placeholder)
+		text.replace(text.find(placeholder), strlen(placeholder), operand);
+
+	return text;
+}
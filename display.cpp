@@ -114,7 +114,7 @@ void Display::update_bg_scanline(Byte current_scanline)
 		int tile_row = floor(map_y / 8);
 		int tile_map_id = (tile_row * 32) + tile_col;
 		Address loc = tile_map_location + tile_map_id;
-		Byte tile_id = memory->read(loc);
+		Byte tile_id = memory->read_video(loc);
 
 		// 3.          8x8
 		// 4.    160x144  
@@ -161,7 +161,7 @@ void Display::update_window_scanline(Byte current_scanline)
 		int tile_row = floor((y - window_y) / 8);
 		int tile_map_id = (tile_row * 32) + tile_col;
 		Address loc = tile_map_location + tile_map_id;
-		Byte tile_id = memory->read(loc);
+		Byte tile_id = memory->read_video(loc);
 
 		// 2.          8x8
 		// 3.    160x144  
@@ -215,8 +215,8 @@ void Display::update_bg_tile_pixel(Byte palette, int display_x, int display_y, i
 	}
 
 	Byte
-		high = memory->read(offset + (tile_y * 2) + 1),
-		low = memory->read(offset + (tile_y * 2));
+		high = memory->read_video(offset + (tile_y * 2) + 1),
+		low = memory->read_video(offset + (tile_y * 2));
 
 	sf::Color color = get_pixel_color(palette, low, high, tile_x, false);
 	bg_array.setPixel(display_x, display_y, color);
@@ -256,8 +256,8 @@ void Display::update_window_tile_pixel(Byte palette, int display_x, int display_
 	}
 
 	Byte
-		high = memory->read(offset + (tile_y * 2) + 1),
-		low = memory->read(offset + (tile_y * 2));
+		high = memory->read_video(offset + (tile_y * 2) + 1),
+		low = memory->read_video(offset + (tile_y * 2));
 
 	sf::Color color = get_pixel_color(palette, low, high, tile_x, false);
 
@@ -277,11 +277,11 @@ void Display::render_sprites()
 	for (int sprite_id = 39; sprite_id >= 0; sprite_id--)
 	{
 		Address offset = sprite_data_location + (sprite_id * 4);
-		int y_pos = ((int)memory->read(offset)) - 16;
-		int x_pos = ((int)memory->read(offset + 1)) - 8;
+		int y_pos = ((int)memory->read_video(offset)) - 16;
+		int x_pos = ((int)memory->read_video(offset + 1)) - 8;
 
-		Byte tile_id = memory->read(offset + 2);
-		Byte flags = memory->read(offset + 3);
+		Byte tile_id = memory->read_video(offset + 2);
+		Byte flags = memory->read_video(offset + 3);
 
 		bool use_palette_1 = is_bit_set(flags, BIT_4);
 		Byte sprite_palette = (use_palette_1) ? palette_1 : palette_0;
@@ -321,8 +321,8 @@ void Display::render_sprite_tile(Byte palette, int start_x, int start_y, Byte ti
 		int offset = (tile_id * 16) + sprite_data_location;
 
 		Byte
-			high = memory->read(offset + (y * 2) + 1),
-			low = memory->read(offset + (y * 2));
+			high = memory->read_video(offset + (y * 2) + 1),
+			low = memory->read_video(offset + (y * 2));
 
 		for (int x = 0; x < 8; x++)
 		{
@@ -2,52 +2,370 @@
 
 Emulator::Emulator()
 {
-	cpu.init(&memory);
+	cpu.init(&memory, &scheduler);
 	display.init(&memory);
+	memory.clock = &scheduler.now;
+
+	// interrupts are only checked between instructions, in sync()
+	cpu.on_memory_cycle = [this](int cycles)
+	{
+		scheduler.now += cycles;
+
+		if (scheduler.now >= scheduler.next)
+			catch_up();
+	};
+
+	start_line();
+
+	memory.on_timing_write = [this]()
+	{
+		catch_up();
+		scheduler.request_sync();
+	};
 }
 
 //   CPU
 void Emulator::run()
 {
-	sf::Time time;
+	FramePacer pacer;
+	pacer.start(framerate);
 
 	while (display.window.isOpen())
 	{
-		// CPU cycles to emulate per frame draw
-		float cycles_per_frame = cpu.CLOCK_SPEED / framerate;
-		float time_between_frames = 1000 / framerate;
-		//    
-		int current_cycle = 0;
-
 		handle_events();
 
-		while (current_cycle < cycles_per_frame)
+		emulate_frame();
+
+		pacer.wait();
+		//cout << display.scanlines_rendered << endl;
+		display.scanlines_rendered = 0;
+	}
+
+	pacer.report();
+}
+
+int Emulator::emulate_frame()
+{
+	return accurate_timing ? emulate_frame<AccurateTiming>() : emulate_frame<FastTiming>();
+}
+
+// Emulates one frame worth of CPU cycles, returns the number of instructions executed
+template <class Timing>
+int Emulator::emulate_frame()
+{
+	// CPU cycles to emulate per frame draw
+	double cycles_per_frame = cpu.CLOCK_SPEED / framerate;
+
+	frame_instructions = 0;
+	scheduler.schedule(Scheduler::EVENT_FRAME, scheduler.now + llround(cycles_per_frame));
+
+	// joypad state may have changed between frames
+	idle.arrived = false;
+	cpu.report_loops = skip_idle_loops;
+	scheduler.request_sync();
+
+	for (;;)
+	{
+		// a cached block ends before the next deadline or at a sync request, with the cycles of
+		// all but its last instruction already on the clock
+		if (cpu.use_block_cache && !Timing::per_access)
+			frame_instructions += cpu.run_block();
+		else
 		{
-			Opcode code = memory.read(cpu.reg_PC);
+			cpu.step<Timing>();
+			frame_instructions++;
+		}
+
+		// under AccurateTiming the cycles before each memory access are already on the clock
+		scheduler.now += Timing::per_access ? cpu.num_cycles - cpu.access_cycles : cpu.num_cycles;
 
-			cpu.parse_opcode(code);
-			current_cycle += cpu.num_cycles;
+		cpu.num_cycles = 0;
+		cpu.access_cycles = 0;
+
+		if (scheduler.now >= scheduler.next && sync())
+			break;
+	}
+
+	return frame_instructions;
+}
+
+/*
+	Timers, DMA and LCD are only advanced when the clock reaches the next deadline, or
+	before a write to one of their registers. Advancing them by all the cycles since the
+	last time in one update ends in the same state as advancing them after every
+	instruction, since no threshold is crossed before the deadline and the update at it
+	sees the same cycles past the threshold.
+*/
+void Emulator::catch_up()
+{
+	int cycles = (int)(scheduler.now - synced_cycle);
+	synced_cycle = scheduler.now;
+
+	update_timers();
+
+	if (cycles > 0)
+		memory.advance(cycles);
+
+	update_lcd();
+}
+
+// Runs between instructions once a deadline is reached, a sync was requested or the CPU stopped at a loop
+bool Emulator::sync()
+{
+	Address pc = cpu.reg.PC;
+
+	// the run may have only stopped for a loop
+	if (scheduler.due())
+	{
+		scheduler.synced();
+		catch_up();
+		// LY or LYC may have been written
+		compare_ly();
+		do_interrupts();
+		schedule_events();
+	}
+
+	if (skip_idle_loops)
+	{
+		// a short backward branch that was not followed by an interrupt
+		if (cpu.branched_back && cpu.reg.PC == pc)
+			skip_idle_loop();
+
+		if (cpu.halted)
+			skip_halt();
+	}
+
+	cpu.branched_back = false;
+	scheduler.update();
+
+	return scheduler.now >= scheduler.deadline(Scheduler::EVENT_FRAME);
+}
+
+void Emulator::schedule_events()
+{
+	unsigned long long now = scheduler.now;
 
-			update_timers(cpu.num_cycles);
-			update_scanline(cpu.num_cycles);
+	scheduler.schedule(Scheduler::EVENT_TIMER, memory.timer.overflow_cycle());
+	scheduler.schedule(Scheduler::EVENT_LCD, lcd_transition);
+
+	// end of an OAM DMA transfer
+	if (memory.dma_cycles > 0)
+		scheduler.schedule(Scheduler::EVENT_DMA, now + memory.dma_cycles);
+	else
+		scheduler.cancel(Scheduler::EVENT_DMA);
+
+	scheduler.update();
+}
+
+// DIV and TIMA change without an event, a loop polling them can only be skipped up to their next step
+unsigned long long Emulator::next_change()
+{
+	return min(scheduler.earliest(), memory.timer.next_step(scheduler.now));
+}
+
+// Opcodes ranked by the cycles they took, from the counts kept by the CPU and OPCODE_TABLE base cycles
+void Emulator::report_profile()
+{
+	vector<int> opcodes;
+	unsigned long long total = 0;
+
+	for (int i = 0; i < 512; i++)
+	{
+		// the CB prefix is counted again with the opcode it selects
+		if (i == 0xCB || cpu.opcode_counts[i] == 0)
+			continue;
+
+		opcodes.push_back(i);
+		total += cpu.opcode_counts[i] * OPCODE_TABLE[i].cycles;
+	}
+
+	sort(opcodes.begin(), opcodes.end(), [this](int a, int b)
+	{
+		return cpu.opcode_counts[a] * OPCODE_TABLE[a].cycles > cpu.opcode_counts[b] * OPCODE_TABLE[b].cycles;
+	});
+
+	cout << "  top opcodes by cycles:" << endl;
+
+	for (size_t i = 0; i < opcodes.size() && i < 10; i++)
+	{
+		int index = opcodes[i];
+		unsigned long long count = cpu.opcode_counts[index];
+		char line[96];
+
+		snprintf(line, sizeof(line), "    %s%02X  %-16s %12llu  %5.1f%%", (index >= CB_PREFIXED) ? "CB " : "",
+			index & 0xFF, OPCODE_TABLE[index].mnemonic, count, 100.0 * count * OPCODE_TABLE[index].cycles / total);
+		cout << line << endl;
+	}
+}
+
+/*
+	Idle loop fast-forward
+
+	A polling loop (see CPU::is_polling_loop) that went round once without any
+	timer, divider or LCD change and came back to the same registers will keep doing
+	exactly that until the next such change, as nothing else can modify the memory
+	it reads. All those iterations are skipped at once: timers and LCD are advanced
+	by their cycles in one update, which ends in the same state as going through them
+	one instruction at a time since no threshold is crossed in between.
+*/
+void Emulator::skip_idle_loop()
+{
+	Address pc = cpu.reg.PC;
+
+	// a short backward branch to somewhere else gives a new candidate
+	if (pc != idle.location)
+	{
+		idle.location = pc;
+		idle.polling = cpu.is_polling_loop(pc);
+		idle.arrived = false;
+		return;
+	}
+
+	if (!idle.polling)
+		return;
+
+	Registers registers = cpu.get_registers();
+	unsigned long long next_event = next_change();
+	long long iteration = (long long)(scheduler.now - idle.cycle);
+
+	bool repeating = idle.arrived && iteration > 0 && scheduler.now < idle.next_event &&
+		registers.AF == idle.registers.AF && registers.BC == idle.registers.BC &&
+		registers.DE == idle.registers.DE && registers.HL == idle.registers.HL &&
+		registers.SP == idle.registers.SP;
+
+	if (repeating)
+	{
+		// stay short of the next event, the end of the frame included
+		int iterations = (int)(((long long)(next_event - scheduler.now) - 1) / iteration);
+
+		if (iterations > 0)
+		{
+			unsigned long long cycles = iterations * iteration;
+
+			scheduler.now += cycles;
+			skipped_instructions += (unsigned long long)iterations * (frame_instructions - idle.instructions);
+			skipped_cycles += cycles;
+
+			catch_up();
 			do_interrupts();
+			schedule_events();
 
-			cpu.num_cycles = 0;
+			next_event = next_change();
 		}
+	}
+
+	idle.arrived = true;
+	idle.registers = registers;
+	idle.cycle = scheduler.now;
+	idle.instructions = frame_instructions;
+	idle.next_event = next_event;
+}
 
-		//display.render();
-		//cout << "frame " << current_cycle << endl;
-		current_cycle = 0;
+/*
+	A halted CPU repeats HALT, 4 cycles at a time, until do_interrupts wakes it up.
+	Interrupts are only requested when a timer or LCD threshold is crossed (or on
+	input, between frames), so the clock moves straight to the first repeat that
+	reaches the next event, over and over until the CPU wakes up or the frame ends.
+*/
+void Emulator::skip_halt()
+{
+	unsigned long long frame_end = scheduler.deadline(Scheduler::EVENT_FRAME);
 
-		int frame_time = time.asMilliseconds();
+	while (cpu.halted && scheduler.now < frame_end)
+	{
+		unsigned long long cycles = max(((scheduler.earliest() - scheduler.now + 3) / 4) * 4, 4ULL);
 
-		float sleep_time = time_between_frames - frame_time;
-		if (frame_time < time_between_frames)
-			sf::sleep(sf::milliseconds(sleep_time));
-		time = time.Zero;
-		//cout << display.scanlines_rendered << endl;
+		scheduler.now += cycles;
+		skipped_cycles += cycles;
+
+		catch_up();
+		do_interrupts();
+		schedule_events();
+	}
+}
+
+// Runs the loaded ROM for a number of frames as fast as possible and reports throughput
+void Emulator::benchmark(int frames)
+{
+	sf::Clock clock;
+	long long instructions = 0;
+	unsigned long long memory_reads = cpu.memory_reads;
+	unsigned long long skipped = skipped_cycles;
+	unsigned long long skipped_polls = skipped_instructions;
+	unsigned long long fusion_hits[CPU::FUSION_IDIOMS];
+	copy(begin(cpu.fusion_hits), end(cpu.fusion_hits), fusion_hits);
+
+	for (int i = 0; i < frames; i++)
+	{
+		instructions += emulate_frame();
 		display.scanlines_rendered = 0;
 	}
+
+	float seconds = clock.getElapsedTime().asSeconds();
+	memory_reads = cpu.memory_reads - memory_reads;
+
+	cout << memory.rom_name << ": " << frames << " frames, " << instructions << " instructions in "
+		<< seconds << " s (" << (instructions / seconds) / 1000000 << " MIPS, "
+		<< (frames / seconds) / framerate << "x speed, "
+		<< (double)memory_reads / instructions << " memory reads per instruction)" << endl;
+
+	if (cpu.profile)
+		report_profile();
+
+	if (skip_idle_loops)
+		cout << "  idle time skipped: " << 100.0 * (skipped_cycles - skipped) / (frames * (cpu.CLOCK_SPEED / framerate)) << "% of cycles, "
+			<< skipped_instructions - skipped_polls << " polling loop instructions not executed" << endl;
+
+	if (cpu.use_block_cache && cpu.use_fusion)
+	{
+		cout << "  fused idioms:";
+
+		for (int i = 0; i < CPU::FUSION_IDIOMS; i++)
+			cout << " " << CPU::fusion_names[i] << " " << cpu.fusion_hits[i] - fusion_hits[i];
+
+		cout << endl;
+	}
+}
+
+/*
+	Bit-heavy microbenchmark: every CB prefixed instruction except those targeting H and L
+	(which would move (HL) away from its scratch byte) is written to WRAM and the block is
+	executed iterations times. No ROM is needed.
+*/
+void Emulator::benchmark_bit_ops(int iterations)
+{
+	const Address program = 0xC000;
+	int length = 0;
+
+	for (int code = 0; code < 256; code++)
+	{
+		int target = code & 7;
+
+		if (target == 4 || target == 5)
+			continue;
+
+		memory.write(program + length * 2, 0xCB);
+		memory.write(program + length * 2 + 1, code);
+		length++;
+	}
+
+	cpu.reg.HL = 0xD000;
+
+	sf::Clock clock;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		cpu.reg.PC = program;
+
+		for (int j = 0; j < length; j++)
+			cpu.step();
+	}
+
+	float seconds = clock.getElapsedTime().asSeconds();
+	long long instructions = (long long)iterations * length;
+
+	cout << "CB instructions: " << instructions << " in " << seconds << " s ("
+		<< seconds * 1e9 / instructions << " ns per instruction)" << endl;
 }
 
 //     -
@@ -169,246 +487,151 @@ int Emulator::get_key_id(Key key)
 	}
 }
 
-void Emulator::update_divider(int cycles)
+// TIMA overflows the timer still has to be told about, there may be more than one since the last sync
+void Emulator::update_timers()
 {
-	divider_counter += cycles;
-
-	if (divider_counter >= 256) // 16384 Hz
-	{
-		divider_counter = 0;
-		memory.DIV.set(memory.DIV.get() + 1);
-	}
-}
-
-//   opcode   ,   Nintendo
-void Emulator::update_timers(int cycles)
-{
-	update_divider(cycles);
-
-	//     
-	Byte new_freq = get_timer_frequency();
-
-	if (timer_frequency != new_freq)
-	{
-		set_timer_frequency();
-		timer_frequency = new_freq;
-	}
-
-	if (timer_enabled())
+	while (scheduler.now >= memory.timer.overflow_cycle())
 	{
-		timer_counter -= cycles;
-
-		//       
-		if (timer_counter <= 0)
-		{
-			Byte timer_value = memory.TIMA.get();
-			set_timer_frequency();
-
-			//  ,  
-			if (timer_value == 255)
-			{
-				memory.TIMA.set(memory.TMA.get());
-				request_interrupt(INTERRUPT_TIMER);
-			}
-			else
-			{
-				memory.TIMA.set(timer_value + 1);
-			}
-		}
+		memory.timer.overflow(memory.TMA.get());
+		request_interrupt(INTERRUPT_TIMER);
 	}
 }
 
-bool Emulator::timer_enabled()
-{
-	return memory.TAC.is_bit_set(BIT_2);
-}
-
-Byte Emulator::get_timer_frequency()
+void Emulator::request_interrupt(Byte id)
 {
-	return (memory.TAC.get() & 0x3);
+	memory.IF.set_bit(id);
+	memory.update_interrupts();
 }
 
-void Emulator::set_timer_frequency()
+void Emulator::do_interrupts()
 {
-	Byte frequency = get_timer_frequency();
-	timer_frequency = frequency;
-
-	switch (frequency)
+	// EI takes effect at the end of the instruction after it
+	if (cpu.interrupt_enable_delay > 0)
 	{
-		// timer_counter calculated by (Clock Speed / selected frequency)
-	case 0: timer_counter = 1024; break; // 4096 Hz
-	case 1: timer_counter = 16; break; // 262144 Hz
-	case 2: timer_counter = 64; break; // 65536 Hz
-	case 3: timer_counter = 256; break; // 16384 Hz
+		if (--cpu.interrupt_enable_delay == 0)
+			cpu.interrupt_master_enable = true;
+		else
+			scheduler.request_sync();
 	}
-}
 
-void Emulator::request_interrupt(Byte id)
-{
-	memory.IF.set_bit(id);
-}
+	Byte pending = memory.pending_interrupts;
 
-void Emulator::do_interrupts()
-{
-	//    
-	if (memory.IF.get() > 0)
+	if (pending == 0)
+		return;
+
+	//   CPU,   ,    
+	if (cpu.halted)
 	{
-		//   CPU,   ,    
-		if (memory.IE.get() > 0)
-		{
-			if (cpu.halted)
-			{
-				cpu.halted = false;
-				cpu.reg_PC += 1;
-			}
-		}
-		//              
-		for (int i = 0; i < 5; i++)
-		{
-			if (memory.IF.is_bit_set(i))
-			{
-				if (memory.IE.is_bit_set(i))
-				{
-					// IME    ,
-					//     
-					if (cpu.interrupt_master_enable)
-					{
-						service_interrupt(i);
-					}
-				}
-			}
-		}
+		cpu.halted = false;
+		cpu.reg.PC += 1;
 	}
+
+	// IME    ,
+	//     .
+	// Lower bits have priority, only one is serviced at a time
+	if (cpu.interrupt_master_enable)
+		service_interrupt(lowest_bit(pending));
 }
 
 void Emulator::service_interrupt(Byte id)
 {
 	cpu.interrupt_master_enable = false;
 	memory.IF.clear_bit(id);
+	memory.update_interrupts();
 
 	//      
-	memory.write(--cpu.reg_SP, high_byte(cpu.reg_PC));
-	memory.write(--cpu.reg_SP, low_byte(cpu.reg_PC));
+	memory.write(--cpu.reg.SP, high_byte(cpu.reg.PC));
+	memory.write(--cpu.reg.SP, low_byte(cpu.reg.PC));
 
 	switch (id)
 	{
-	case INTERRUPT_VBLANK: cpu.reg_PC = 0x40; break;
-	case INTERRUPT_LCDC:   cpu.reg_PC = 0x48; break;
-	case INTERRUPT_TIMER:  cpu.reg_PC = 0x50; break;
-	case INTERRUPT_SERIAL: cpu.reg_PC = 0x58; break;
-	case INTERRUPT_JOYPAD: cpu.reg_PC = 0x60; break;
+	case INTERRUPT_VBLANK: cpu.reg.PC = 0x40; break;
+	case INTERRUPT_LCDC:   cpu.reg.PC = 0x48; break;
+	case INTERRUPT_TIMER:  cpu.reg.PC = 0x50; break;
+	case INTERRUPT_SERIAL: cpu.reg.PC = 0x58; break;
+	case INTERRUPT_JOYPAD: cpu.reg.PC = 0x60; break;
 	}
 }
 
-void Emulator::set_lcd_status()
+// Runs the PPU through its modes: OAM search, transfer and HBlank on lines 0 - 143, then
+// VBlank on lines 144 - 153. STAT, LY and the LCD interrupts only change here
+void Emulator::update_lcd()
 {
-	Byte status = memory.STAT.get();
-
-	Byte current_line = memory.LY.get();
-	//    LCD
-	Byte current_mode = status & 0x03;
-
-	Byte mode = 0;
-	bool do_interrupt = false;
-
-	//  VBLANK   1
-	if (current_line >= 144)
-	{
-		mode = 1; //    
-		// 1   
-		status = set_bit(status, BIT_0);
-		status = clear_bit(status, BIT_1);
-		do_interrupt = is_bit_set(status, BIT_4);
-
-	}
-	else
+	while (scheduler.now >= lcd_transition)
 	{
-		int mode2_threshold = 456 - 80;
-		int mode3_threshold = mode2_threshold - 172;
+		Byte line = memory.LY.get();
 
-		if (scanline_counter >= mode2_threshold)
-		{
-			mode = 2; //   OAM RAM
-			// 2   
-			status = set_bit(status, BIT_1);
-			status = clear_bit(status, BIT_0);
-			do_interrupt = is_bit_set(status, BIT_5);
-		}
-		else if (scanline_counter >= mode3_threshold)
-		{
-			mode = 3; //     LCD
-			// 3   
-			status = set_bit(status, BIT_1);
-			status = set_bit(status, BIT_0);
-		}
-		else
+		switch (memory.video_mode)
 		{
-			mode = 0; //        
-
-			//     H-blank,   
-			if (current_mode != mode)
-			{
-				//      
-				if (current_line < 144 && display.scanlines_rendered <= 144)
-					display.update_scanline(current_line);
-			}
-
-			// 0   
-			status = clear_bit(status, BIT_1);
-			status = clear_bit(status, BIT_0);
-			do_interrupt = is_bit_set(status, BIT_3);
+		case 2:
+			enter_mode(3);
+			lcd_transition += TRANSFER_CYCLES;
+			break;
+		case 3:
+			//      
+			if (line < 144 && display.scanlines_rendered <= 144)
+				display.update_scanline(line);
+
+			enter_mode(0);
+			lcd_transition += HBLANK_CYCLES;
+			break;
+		default:
+			// end of an HBlank or VBlank line, LY goes back to 0 after line 153
+			memory.LY.set((line < 153) ? line + 1 : 0);
+			compare_ly();
+			start_line();
+			break;
 		}
 	}
+}
 
-	//    ,  
-	if (do_interrupt && (mode != current_mode))
-		request_interrupt(INTERRUPT_LCDC);
+void Emulator::start_line()
+{
+	Byte line = memory.LY.get();
 
-	//   ,   2,   
-	if (memory.LY.get() == memory.LYC.get())
+	if (line < 144)
 	{
-		status = set_bit(status, BIT_2);
+		enter_mode(2);
+		lcd_transition += OAM_SEARCH_CYCLES;
+		return;
+	}
 
-		if (is_bit_set(status, BIT_6))
-			request_interrupt(INTERRUPT_LCDC);
+	if (memory.video_mode != 1)
+		enter_mode(1);
+
+	//    VBLANK
+	if (line == 144)
+	{
+		request_interrupt(INTERRUPT_VBLANK);
+		if (display.scanlines_rendered <= 144)
+			display.render();
 	}
-	//   2,  
-	else
-		status = clear_bit(status, BIT_2);
 
-	memory.STAT.set(status);
-	memory.video_mode = mode;
+	lcd_transition += LINE_CYCLES;
 }
 
-void Emulator::update_scanline(int cycles)
+void Emulator::enter_mode(Byte mode)
 {
-	scanline_counter -= cycles;
+	Byte status = (memory.STAT.get() & 0xFC) | mode;
 
-	set_lcd_status();
+	memory.STAT.set(status);
+	memory.set_video_mode(mode);
 
-	if (memory.LY.get() > 153)
-		memory.LY.clear();
+	// HBlank, VBlank and OAM search interrupts are enabled by STAT bits 3, 4 and 5
+	if (mode != 3 && is_bit_set(status, BIT_3 + mode))
+		request_interrupt(INTERRUPT_LCDC);
+}
 
-	//        
-	if (scanline_counter <= 0)
-	{
-		Byte current_scanline = memory.LY.get();
+void Emulator::compare_ly()
+{
+	Byte status = memory.STAT.get();
+	bool match = memory.LY.get() == memory.LYC.get();
 
-		//      
-		memory.LY.set(++current_scanline);
-		scanline_counter = 456;
+	// bit 2 still holds the previous result
+	if (match && !is_bit_set(status, BIT_2) && is_bit_set(status, BIT_6))
+		request_interrupt(INTERRUPT_LCDC);
 
-		//    VBLANK
-		if (current_scanline == 144)
-		{
-			request_interrupt(INTERRUPT_VBLANK);
-			if (display.scanlines_rendered <= 144)
-				display.render();
-		}
-		//  ,    
-		else if (current_scanline > 153)
-			memory.LY.clear();
-	}
+	memory.STAT.set(match ? set_bit(status, BIT_2) : clear_bit(status, BIT_2));
 }
 
 void Emulator::save_state(int id)
@@ -438,6 +661,13 @@ void Emulator::load_state(int id)
 		memory.load_state(file);
 		file.close();
 
+		// the PPU mode isn't part of the state, restart the loaded line in its first mode
+		Byte mode = (memory.LY.get() < 144) ? 2 : 1;
+		memory.STAT.set((memory.STAT.get() & 0xFC) | mode);
+		memory.set_video_mode(mode);
+		lcd_transition = scheduler.now + ((mode == 2) ? OAM_SEARCH_CYCLES : LINE_CYCLES);
+		scheduler.request_sync();
+
 		cout << "  " << id << endl;
 	}
 }
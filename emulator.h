@@ -7,6 +7,8 @@
 #include "cpu.h"
 #include "memory.h"
 #include "display.h"
+#include "scheduler.h"
+#include "frame_pacer.h"
 
 typedef sf::Keyboard::Key Key;
 
@@ -15,14 +17,26 @@ class Emulator
 public:
 
 	Emulator(); // 
+	void benchmark(int frames); // Run frames without pacing and report throughput
+	void benchmark_bit_ops(int iterations); // Time CB prefixed instructions running from WRAM
 	void run(); //  
 	CPU cpu; //  
 	Memory memory; // 
 	Display display; // 
+	Scheduler scheduler; // Master clock and the deadlines of timer, LCD and DMA events
+	bool skip_idle_loops = true; // Fast-forward HALT and polling loops to the next timer or LCD event
+	unsigned long long skipped_cycles = 0; // Cycles fast-forwarded through HALT and idle loops
+	unsigned long long skipped_instructions = 0; // Polling loop instructions fast-forwarded, never counted as executed
+	bool accurate_timing = false; // Advance timers and LCD on every memory access (AccurateTiming), ignores the block cache
 
 private:
 
-	float framerate = 60; //  
+	double framerate = 4194304.0 / 70224; //  , one LCD refresh (70224 cycles) per frame, about 59.73 Hz
+
+	template <class Timing> int emulate_frame(); // Emulate one frame, returns instructions executed
+	int emulate_frame(); // with the accuracy policy picked by accurate_timing
+	int frame_instructions = 0; // Instructions executed in the current frame
+	void report_profile(); // Print the opcodes that took the most cycles
 
 	// -------- EVENTS ------- //
 	void handle_events(); //  
@@ -36,18 +50,8 @@ private:
 	void save_state(int id); //  
 	void load_state(int id); //  
 
-	// --------- DIVIDER --------- //
-	int divider_counter = 0; //  
-	int divider_frequency = 16384; //   (16384    256  )
-	void update_divider(int cycles); //  
-
 	// ----------TIMERS ---------- //
-	int timer_counter = 0; //  
-	Byte timer_frequency = 0; //  
-	void update_timers(int cycles); //  
-	bool timer_enabled(); //   
-	Byte get_timer_frequency(); //   
-	void set_timer_frequency(); //   
+	void update_timers(); // Reload TIMA and request the interrupt at overflows (DIV and TIMA are in memory.timer)
 
 	// ------- INTERRUPTS ------- //
 	void request_interrupt(Byte id); //  
@@ -55,7 +59,34 @@ private:
 	void service_interrupt(Byte id); //  
 
 	// ------ LCD Display ------ //
-	int scanline_counter = 456; //       
-	void set_lcd_status(); //   LCD
-	void update_scanline(int cycles); //   
+	// Modes of a visible line, 456 cycles in all, and VBlank lines
+	static const int OAM_SEARCH_CYCLES = 80, TRANSFER_CYCLES = 172, HBLANK_CYCLES = 204, LINE_CYCLES = 456;
+	unsigned long long lcd_transition = 0; // Cycle the current mode ends at
+	void update_lcd(); // Run the mode changes up to scheduler.now
+	void start_line(); // Enter the first mode of the line in LY
+	void enter_mode(Byte mode); // Set the STAT mode, lock video memory and request its interrupt
+	void compare_ly(); // Set the LY=LYC flag and request its interrupt when the lines start matching
+
+	// ------ SCHEDULING ------ //
+	unsigned long long synced_cycle = 0; // scheduler.now timers, DMA and LCD are up to date with
+	void catch_up(); // Advance timers, DMA and LCD to scheduler.now
+	bool sync(); // Catch up, interrupts and idle skips between instructions, true at the end of the frame
+	void schedule_events(); // Deadlines of the next timer, LCD and DMA events
+	unsigned long long next_change(); // Earliest event or DIV / TIMA step, what polling loops may see change
+
+	// ------ IDLE LOOPS ------ //
+	struct IdleLoop
+	{
+		Address location = 0; // Start of the last short backward loop
+		bool polling = false; // The loop only reads and tests memory
+		bool arrived = false; // The fields below were recorded at location during this frame
+		Registers registers;
+		unsigned long long cycle = 0;
+		int instructions = 0;
+		unsigned long long next_event = 0;
+	};
+
+	IdleLoop idle;
+	void skip_idle_loop();
+	void skip_halt();
 };
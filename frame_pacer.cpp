@@ -0,0 +1,59 @@
+#include "frame_pacer.h"
+
+#include <thread>
+
+const FramePacer::Clock::duration FramePacer::SPIN_TIME = chrono::milliseconds(2);
+const FramePacer::Clock::duration FramePacer::MAX_LAG = chrono::milliseconds(100);
+
+void FramePacer::start(double frames_per_second)
+{
+	period = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / frames_per_second));
+	deadline = Clock::now();
+	last_frame = deadline;
+
+	frames = 0;
+	late_frames = 0;
+	resets = 0;
+	total_jitter = 0;
+	max_jitter = 0;
+}
+
+void FramePacer::wait()
+{
+	deadline += period;
+	Clock::time_point now = Clock::now();
+
+	if (now > deadline + MAX_LAG)
+	{
+		deadline = now;
+		resets++;
+	}
+	else if (now > deadline)
+		late_frames++;
+	else
+	{
+		if (deadline - now > SPIN_TIME)
+			this_thread::sleep_for(deadline - now - SPIN_TIME);
+
+		while (Clock::now() < deadline)
+			this_thread::yield();
+	}
+
+	now = Clock::now();
+
+	double jitter = fabs(chrono::duration<double, milli>(now - last_frame - period).count());
+	total_jitter += jitter;
+	max_jitter = max(max_jitter, jitter);
+	last_frame = now;
+	frames++;
+}
+
+void FramePacer::report()
+{
+	if (frames == 0)
+		return;
+
+	cout << "frame pacing: " << frames << " frames of " << chrono::duration<double, milli>(period).count()
+		<< " ms, jitter " << total_jitter / frames << " ms average, " << max_jitter << " ms max, "
+		<< late_frames << " late, " << resets << " resynced" << endl;
+}
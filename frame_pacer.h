@@ -0,0 +1,40 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+
+/*
+	Paces emulated frames to the Game Boy refresh rate on the host's monotonic clock
+
+	Every frame is due one period after the previous frame was due, not after it
+	actually finished, so a late frame is made up by shorter waits on the following
+	ones. When the emulation falls more than MAX_LAG behind (a breakpoint, a stalled
+	window) the deadlines start over from the current time instead of rushing through
+	the backlog. Waits sleep until SPIN_TIME before the deadline and spin the rest,
+	as the OS may wake a sleeping thread a scheduler tick late.
+*/
+class FramePacer
+{
+public:
+	typedef chrono::steady_clock Clock;
+
+	void start(double frames_per_second);
+	void wait(); // Blocks until the next frame is due
+	void report(); // Prints frame time statistics since start()
+
+private:
+	static const Clock::duration SPIN_TIME;
+	static const Clock::duration MAX_LAG;
+
+	Clock::duration period;
+	Clock::time_point deadline;
+	Clock::time_point last_frame;
+
+	// Frame time statistics: intervals between the ends of consecutive waits
+	unsigned long long frames = 0;
+	unsigned long long late_frames = 0; // started after their deadline
+	unsigned long long resets = 0;      // deadlines restarted after falling behind
+	double total_jitter = 0;            // sum of the differences to the period, in ms
+	double max_jitter = 0;
+};
@@ -0,0 +1,333 @@
+#include "cpu.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+	Call-threaded code for hot blocks
+
+	Blocks of the cached interpreter that have run JIT_THRESHOLD times are translated
+	to x86-64 that calls each instruction's handler in turn, in place of the micro op
+	loop. Only register loads, 16-bit increments and NOPs are emitted inline. ALU, flag
+	and branch instructions stay calls and no guest register lives in a host register,
+	so this is not a recompiler: cycle counting, flags and memory accesses are exactly
+	those of the interpreter. PC and cycle updates of inlined instructions are batched
+	and written back before each call and at the end.
+
+	Only ROM is ever compiled, so the code can't be modified under us; blocks that
+	address I/O registers directly ($FF00 - $FFFF) stay on the interpreter.
+	Compiled code returns early if a handler wrote to the memory controller or asked
+	for a sync.
+
+	The code buffer is mapped read-write; the pages a block is emitted to are switched
+	to read-execute once it is complete, and back to read-write only while the next
+	block is appended after it.
+*/
+
+CodeBuffer::~CodeBuffer()
+{
+	if (!memory)
+		return;
+
+#if defined(_WIN32)
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, CAPACITY);
+#endif
+}
+
+static size_t page_size()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+bool CodeBuffer::reserve(size_t bytes)
+{
+	if (!memory && !failed)
+	{
+#if defined(_WIN32)
+		memory = (Byte*)VirtualAlloc(nullptr, CAPACITY, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+		void* region = mmap(nullptr, CAPACITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		memory = (region == MAP_FAILED) ? nullptr : (Byte*)region;
+#endif
+		if (!memory)
+		{
+			failed = true;
+			cout << "JIT: could not allocate code memory" << endl;
+		}
+	}
+
+	if (!memory || failed || used + bytes > CAPACITY)
+		return false;
+
+	// the page the block starts on may hold the end of the previous, already executable block
+	return protect(used, used + bytes, false);
+}
+
+bool CodeBuffer::finish(Byte* start)
+{
+	size_t begin = start - memory;
+
+	if (!protect(begin, used, true))
+		return false;
+
+#if defined(_WIN32)
+	FlushInstructionCache(GetCurrentProcess(), start, used - begin);
+#else
+	__builtin___clear_cache((char*)start, (char*)(memory + used));
+#endif
+
+	return true;
+}
+
+// Switches the pages covering begin - end between read-write and read-execute
+bool CodeBuffer::protect(size_t begin, size_t end, bool executable)
+{
+	begin -= begin % page_size();
+
+#if defined(_WIN32)
+	DWORD previous;
+	bool done = VirtualProtect(memory + begin, end - begin, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous) != 0;
+#else
+	bool done = mprotect(memory + begin, end - begin, executable ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE)) == 0;
+#endif
+
+	if (!done)
+	{
+		failed = true;
+		cout << "JIT: could not change the protection of code memory" << endl;
+	}
+
+	return done;
+}
+
+Byte* CodeBuffer::position()
+{
+	return memory + used;
+}
+
+void CodeBuffer::emit(Byte data)
+{
+	memory[used++] = data;
+}
+
+void CodeBuffer::emit16(Byte_2 data)
+{
+	emit(low_byte(data));
+	emit(high_byte(data));
+}
+
+void CodeBuffer::emit32(uint32_t data)
+{
+	emit16(data & 0xFFFF);
+	emit16(data >> 16);
+}
+
+void CodeBuffer::emit64(uint64_t data)
+{
+	emit32(data & 0xFFFFFFFF);
+	emit32(data >> 32);
+}
+
+// Called from compiled code for instructions that are not inlined.
+// Returns true when the memory controller was written to and the block has to stop.
+bool CPU::call_handler(CPU* cpu, const MicroOp* micro_op)
+{
+	unsigned int controller_writes = cpu->memory->controller_writes;
+
+	// the clock includes the instructions before this one, as in the cached interpreter
+	cpu->scheduler->now += cpu->num_cycles;
+	cpu->num_cycles = 0;
+
+	cpu->block_operands = micro_op->operands;
+	(cpu->*micro_op->handler)();
+
+	return cpu->memory->controller_writes != controller_writes || cpu->scheduler->now + cpu->num_cycles >= cpu->scheduler->next;
+}
+
+// <opcode> [rbx + offset of field], rbx always holds the CPU
+void CPU::emit_field(Byte opcode, Byte extension, const void* field)
+{
+	code_buffer.emit(opcode);
+	code_buffer.emit(0x83 | (extension << 3));
+	code_buffer.emit32((uint32_t)((const Byte*)field - (const Byte*)this));
+}
+
+// Writes back PC and cycles of the inlined instructions since the last call
+void CPU::emit_pending(int& pending_pc, int& pending_cycles)
+{
+	if (pending_pc)
+	{
+		// add word [PC], pending_pc
+		code_buffer.emit(0x66);
+		emit_field(0x81, 0, &reg.PC);
+		code_buffer.emit16(pending_pc);
+	}
+
+	if (pending_cycles)
+	{
+		// add dword [num_cycles], pending_cycles
+		emit_field(0x81, 0, &num_cycles);
+		code_buffer.emit32(pending_cycles);
+	}
+
+	pending_pc = 0;
+	pending_cycles = 0;
+}
+
+// mov eax, executed; add rsp, 32; pop rbx; ret
+void CPU::emit_return(int executed)
+{
+	code_buffer.emit(0xB8);
+	code_buffer.emit32(executed);
+	code_buffer.emit(0x48); code_buffer.emit(0x83); code_buffer.emit(0xC4); code_buffer.emit(0x20);
+	code_buffer.emit(0x5B);
+	code_buffer.emit(0xC3);
+}
+
+// Emits the instruction inline if it only moves data between registers, returns false otherwise.
+// Its PC and cycle updates are left to the caller.
+bool CPU::compile_instruction(Opcode code, Byte_2 operand)
+{
+	Byte* registers[8] = { &reg.B, &reg.C, &reg.D, &reg.E, &reg.H, &reg.L, nullptr, &reg.A };
+	Byte_2* pairs[4] = { &reg.BC, &reg.DE, &reg.HL, &reg.SP };
+
+	// NOP
+	if (code == 0x00)
+		return true;
+
+	// LD r, r
+	if (code >= 0x40 && code <= 0x7F && code != 0x76)
+	{
+		Byte* destination = registers[(code >> 3) & 7];
+		Byte* source = registers[code & 7];
+
+		if (!destination || !source)
+			return false;
+
+		// mov al, [source]; mov [destination], al
+		if (destination != source)
+		{
+			emit_field(0x8A, 0, source);
+			emit_field(0x88, 0, destination);
+		}
+
+		return true;
+	}
+
+	// LD r, n: mov byte [r], n
+	if ((code & 0xC7) == 0x06 && code != 0x36)
+	{
+		emit_field(0xC6, 0, registers[(code >> 3) & 7]);
+		code_buffer.emit(low_byte(operand));
+
+		return true;
+	}
+
+	// LD rr, nn: mov word [rr], nn
+	if ((code & 0xCF) == 0x01)
+	{
+		code_buffer.emit(0x66);
+		emit_field(0xC7, 0, pairs[code >> 4]);
+		code_buffer.emit16(operand);
+
+		return true;
+	}
+
+	// INC rr / DEC rr: inc word [rr] / dec word [rr]
+	if ((code & 0xCF) == 0x03 || (code & 0xCF) == 0x0B)
+	{
+		code_buffer.emit(0x66);
+		emit_field(0xFF, (code & 0x08) ? 1 : 0, pairs[code >> 4]);
+
+		return true;
+	}
+
+	return false;
+}
+
+CPU::CompiledBlock CPU::compile_block(const BasicBlock* block)
+{
+#if JIT_SUPPORTED
+	// worst case is a call for every instruction
+	if (!code_buffer.reserve(64 + block->ops.size() * 64))
+		return nullptr;
+
+	Byte* entry = code_buffer.position();
+	int pending_pc = 0;
+	int pending_cycles = 0;
+	int executed = 0;
+
+	// push rbx; sub rsp, 32 (keeps the stack aligned, and is the shadow space on Windows)
+	code_buffer.emit(0x53);
+	code_buffer.emit(0x48); code_buffer.emit(0x83); code_buffer.emit(0xEC); code_buffer.emit(0x20);
+
+	// mov rbx, <first argument>
+	code_buffer.emit(0x48); code_buffer.emit(0x89);
+#if defined(_WIN32)
+	code_buffer.emit(0xCB); // rcx
+#else
+	code_buffer.emit(0xFB); // rdi
+#endif
+
+	for (size_t i = 0; i < block->ops.size(); i++)
+	{
+		const MicroOp& micro_op = block->ops[i];
+		executed += micro_op.length;
+
+		if (micro_op.length == 1 && micro_op.code != 0xCB && compile_instruction(micro_op.code, micro_op.operands[0]))
+		{
+			pending_pc += OPCODE_TABLE[micro_op.code].length;
+			pending_cycles += OPCODE_TABLE[micro_op.code].cycles * 4;
+			continue;
+		}
+
+		emit_pending(pending_pc, pending_cycles);
+
+#if defined(_WIN32)
+		// mov rcx, rbx; mov rdx, &micro_op
+		code_buffer.emit(0x48); code_buffer.emit(0x89); code_buffer.emit(0xD9);
+		code_buffer.emit(0x48); code_buffer.emit(0xBA);
+#else
+		// mov rdi, rbx; mov rsi, &micro_op
+		code_buffer.emit(0x48); code_buffer.emit(0x89); code_buffer.emit(0xDF);
+		code_buffer.emit(0x48); code_buffer.emit(0xBE);
+#endif
+		code_buffer.emit64((uint64_t)(uintptr_t)&micro_op);
+
+		// mov rax, call_handler; call rax
+		code_buffer.emit(0x48); code_buffer.emit(0xB8);
+		code_buffer.emit64((uint64_t)(uintptr_t)&CPU::call_handler);
+		code_buffer.emit(0xFF); code_buffer.emit(0xD0);
+
+		// test al, al; jz over the early return
+		code_buffer.emit(0x84); code_buffer.emit(0xC0);
+		code_buffer.emit(0x74); code_buffer.emit(0x0B);
+		emit_return(executed);
+	}
+
+	emit_pending(pending_pc, pending_cycles);
+	emit_return(executed);
+
+	if (!code_buffer.finish(entry))
+		return nullptr;
+
+	blocks_compiled++;
+	return reinterpret_cast<CompiledBlock>(entry);
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "types.h"
+
+// Native code is only generated on x86-64, other targets stay on the cached interpreter
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Memory that compiled blocks are appended to, allocated on first use. Pages are never
+// writable and executable at once: reserve() makes the space for the next block writable
+// and finish() turns it executable once the block is complete
+class CodeBuffer
+{
+public:
+	CodeBuffer() = default;
+	CodeBuffer(const CodeBuffer&) = delete;
+	CodeBuffer& operator=(const CodeBuffer&) = delete;
+	~CodeBuffer();
+
+	static const size_t CAPACITY = 16 * 1024 * 1024;
+
+	// Makes sure the next block can take up to bytes and opens them for writing,
+	// false if the buffer is full or unavailable
+	bool reserve(size_t bytes);
+	// Makes the code emitted since start executable, false if it can't be run
+	bool finish(Byte* start);
+	Byte* position();
+
+	void emit(Byte data);
+	void emit16(Byte_2 data);
+	void emit32(uint32_t data);
+	void emit64(uint64_t data);
+
+private:
+	Byte* memory = nullptr;
+	size_t used = 0;
+	bool failed = false;
+
+	bool protect(size_t begin, size_t end, bool executable);
+};
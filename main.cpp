@@ -2,9 +2,86 @@
 #include "cpu.h"
 #include "display.h"
 
+// Usage: Emulation [--cached | --jit | --accurate] [--profile] [--host-rtc] [--benchmark frames | --bit-benchmark iterations | --flags-test | --timing-test] [rom ...]
 int main(int argc, char *args[])
 {
+	bool cached = false; // Run ROM code through the cached interpreter
+	bool jit = false; // and run hot blocks as call-threaded code
+	bool profile = false; // Count executed opcodes (plain interpreter only)
+	bool accurate = false; // M-cycle accurate memory timing, always interpreted
+	bool host_rtc = false; // MBC3 clock follows the host clock instead of emulated time
+
+	while (argc > 1)
+	{
+		string option = args[1];
+
+		if (option == "--jit")
+			jit = cached = true;
+		else if (option == "--cached")
+			cached = true;
+		else if (option == "--profile")
+			profile = true;
+		else if (option == "--accurate")
+			accurate = true;
+		else if (option == "--host-rtc")
+			host_rtc = true;
+		else
+			break;
+
+		args++;
+		argc--;
+	}
+
+	// Headless throughput measurement over every ROM given on the command line
+	if (argc > 2 && string(args[1]) == "--benchmark")
+	{
+		int frames = atoi(args[2]);
+
+		for (int i = 3; i < argc; i++)
+		{
+			Emulator emulator;
+			emulator.cpu.use_block_cache = cached;
+			emulator.cpu.use_jit = jit;
+			emulator.cpu.profile = profile;
+			emulator.accurate_timing = accurate;
+			emulator.memory.rtc_host_time = host_rtc;
+			emulator.memory.battery_saves = false; // leave the player's saves alone
+			emulator.memory.load_rom(args[i]);
+			emulator.benchmark(frames);
+		}
+
+		return 0;
+	}
+
+	if (argc > 2 && string(args[1]) == "--bit-benchmark")
+	{
+		Emulator emulator;
+		emulator.benchmark_bit_ops(atoi(args[2]));
+
+		return 0;
+	}
+
+	// Lazy flags against flags worked out eagerly, exits with 1 on a mismatch
+	if (argc > 1 && string(args[1]) == "--flags-test")
+	{
+		Emulator emulator;
+
+		return emulator.cpu.test_flags() ? 0 : 1;
+	}
+
+	// Cycles and PC of every opcode against OPCODE_TABLE, under both timing policies
+	if (argc > 1 && string(args[1]) == "--timing-test")
+	{
+		Emulator emulator;
+
+		return emulator.cpu.test_timing() ? 0 : 1;
+	}
+
 	Emulator emulator;
+	emulator.cpu.use_block_cache = cached;
+	emulator.cpu.use_jit = jit;
+	emulator.accurate_timing = accurate;
+	emulator.memory.rtc_host_time = host_rtc;
 
 	//string name = "cpu/cpu_instrs";
 	//string name = "instr_timing";
@@ -12,7 +89,10 @@ int main(int argc, char *args[])
 	//emulator.memory.load_rom("tests/" + name + ".gb");
 	//emulator.memory.load_rom("roms/Dr. Mario.gb");
 	//emulator.memory.load_rom("roms/kirby.gb");
-	emulator.memory.load_rom("roms/Donkey Kong.gb");
+	if (argc > 1)
+		emulator.memory.load_rom(args[1]);
+	else
+		emulator.memory.load_rom("roms/Donkey Kong.gb");
 	//emulator.memory.load_rom("roms/Mortal Kombat.gb");
 	//emulator.memory.load_rom("roms/Legend of Zelda.gb");
 	//emulator.memory.load_rom("roms/Tetris.gb");
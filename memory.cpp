@@ -1,5 +1,7 @@
 #include "memory.h"
 
+#include <chrono>
+
 Memory::Memory()
 {
 	WRAM = vector<Byte>(0x2000); // $C000 - $DFFF, 8kB Working RAM
@@ -28,9 +30,57 @@ Memory::Memory()
 	IF   = MemoryRegister(&ZRAM[0x0F]);
 	IE   = MemoryRegister(&ZRAM[0xFF]);
 
+	map_pages();
 	reset();
 }
 
+Memory::~Memory()
+{
+	// flushes and unmaps the battery file
+	if (controller != nullptr)
+		visit_controller([](auto& mbc) { delete &mbc; });
+}
+
+// Fills both page tables, the controller maps its own areas again on every bank switch
+void Memory::map_pages()
+{
+	fill(begin(read_pages), end(read_pages), nullptr);
+	fill(begin(write_pages), end(write_pages), nullptr);
+
+	// Working RAM and its shadow at $E000 - $FDFF
+	for (int page = 0xC0; page < 0xFE; page++)
+		read_pages[page] = write_pages[page] = &WRAM[(page << 8) & 0x1FFF];
+
+	map_video();
+
+	if (controller != nullptr)
+		visit_controller([this](auto& mbc) { mbc.map_pages(read_pages, write_pages); });
+}
+
+// Maps VRAM and OAM, or leaves them to the handlers while the display has them locked:
+// OAM in mode 2, VRAM and OAM in mode 3, neither while the LCD is off
+void Memory::map_video()
+{
+	if (dma_cycles > 0)
+		return;
+
+	bool lcd_on = LCDC.is_bit_set(BIT_7);
+	bool vram_locked = lcd_on && video_mode == 3;
+	bool oam_locked = lcd_on && video_mode >= 2;
+
+	for (int page = 0x80; page < 0xA0; page++)
+		read_pages[page] = write_pages[page] = vram_locked ? nullptr : &VRAM[(page << 8) & 0x1FFF];
+
+	read_pages[0xFE] = write_pages[0xFE] = oam_locked ? nullptr : &OAM[0];
+}
+
+// Called by the LCD on every mode change
+void Memory::set_video_mode(Byte mode)
+{
+	video_mode = mode;
+	map_video();
+}
+
 void Memory::reset()
 {
 	fill(WRAM.begin(), WRAM.end(), 0);
@@ -55,6 +105,8 @@ void Memory::reset()
 	WX.set(0x00);
 	IF.set(0x00);
 	IE.set(0x00);
+	update_interrupts();
+	timer.reset(now());
 
 	// Initialize input to HIGH state (unpressed)
 	joypad_buttons = 0xF;
@@ -63,8 +115,18 @@ void Memory::reset()
 
 void Memory::load_rom(std::string location)
 {
-	ifstream input(location, ios::binary);
-	vector<Byte> buffer((istreambuf_iterator<char>(input)), (istreambuf_iterator<char>()));
+	auto start = chrono::steady_clock::now();
+
+	// Mapped straight from the file, or shared with other instances that have it open
+	shared_ptr<const RomImage> rom = RomImage::open(location);
+
+	if (!rom)
+	{
+		cout << "Could not open ROM " << location << endl;
+		return;
+	}
+
+	const Byte* buffer = rom->data();
 
 	// print cartrige data
 	string title = "";
@@ -115,9 +177,24 @@ void Memory::load_rom(std::string location)
 	cart_types[0xFF] = "Hudson HuC-1";
 
 	Byte cart = buffer[0x0147];
+
+	// MMM01 multicarts keep the menu, and the header naming the controller, in their last 32kB
+	if (rom->size() > 0x8000)
+	{
+		Byte menu_cart = buffer[rom->size() - 0x8000 + 0x0147];
+
+		if (menu_cart >= 0x0B && menu_cart <= 0x0D)
+			cart = menu_cart;
+	}
+
 	cout << "Cartridge Type: " << cart_types[cart] << endl;
 
-	delete controller;
+	// External RAM from the header, at least one bank so the $A000 - $BFFF pages can be mapped
+	const size_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+	size_t ram_size = (buffer[0x0149] < 6) ? ram_sizes[buffer[0x0149]] : 0;
+
+	if (controller != nullptr)
+		visit_controller([](auto& mbc) { delete &mbc; });
 
 	// Assign memory controller based on cartridge specification
 	switch (cart)
@@ -126,11 +203,18 @@ void Memory::load_rom(std::string location)
 		case 0x02:
 		case 0x03:
 			controller = new MemoryController1();
+			controller_type = MBC1;
 			break;
 		case 0x05:
 		case 0x06:
-			cout << "CONTROLLER NOT IMPLEMENTED" << endl;
 			controller = new MemoryController2();
+			controller_type = MBC2;
+			break;
+		case 0x0B:
+		case 0x0C:
+		case 0x0D:
+			controller = new MemoryControllerMMM01();
+			controller_type = MMM01;
 			break;
 		case 0x0F:
 		case 0x10:
@@ -138,32 +222,69 @@ void Memory::load_rom(std::string location)
 		case 0x12:
 		case 0x13:
 			controller = new MemoryController3();
+			controller_type = MBC3;
+			break;
+		case 0x19:
+		case 0x1A:
+		case 0x1B:
+		case 0x1C:
+		case 0x1D:
+		case 0x1E:
+			controller = new MemoryController5();
+			controller_type = MBC5;
 			break;
 		default:
 			controller = new MemoryController0();
+			controller_type = MBC0;
 			break;
 	}
 
 	// Initialize controller with cartridge data
-	controller->init(buffer);
+	visit_controller([&rom, ram_size](auto& mbc) { mbc.init(rom, max(ram_size, (size_t)0x2000)); });
 
-	Byte rsize = buffer[0x0148];
-	cout << "ROM Size: " << (32 << rsize) << "kB " << pow(2, rsize + 1) << " banks" << endl;
-	int size, banks;
-	switch (buffer[0x149])
+	if (controller_type == MBC3)
+		static_cast<MemoryController3*>(controller)->set_clock(clock, rtc_host_time);
+
+	// Battery backed RAM is kept in <rom>.sav
+	switch (cart)
 	{
-		case 1: size = 2; banks = 1;
-		case 2: size = 8; banks = 1;
-		case 3: size = 32; banks = 4;
-		case 4: size = 128; banks = 16;
-		default: size = 0; banks = 0;
+		case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F:
+		case 0x10: case 0x13: case 0x1B: case 0x1E:
+		{
+			if (!battery_saves)
+				break;
+
+			string path = location;
+			size_t extension = path.find_last_of('.');
+			size_t directory = path.find_last_of("/\\");
+
+			if (extension != string::npos && (directory == string::npos || extension > directory))
+				path.erase(extension);
+
+			path += ".sav";
+			bool mapped = visit_controller([&path](auto& mbc) { return mbc.attach_battery(path); });
+
+			cout << "Battery RAM: " << path << (mapped ? "" : " (could not be mapped, not saved)") << endl;
+			break;
+		}
 	}
-	cout << "RAM Size: " << size << "kB " << banks << " banks" << endl;
+	map_pages();
+
+	double load_time = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "ROM Image: " << rom->size() / 1024 << "kB " << ((rom.use_count() > 2) ? "shared" : "mapped")
+		<< ", loaded in " << load_time << " ms" << endl;
+
+	Byte rsize = buffer[0x0148];
+	cout << "ROM Size: " << (32 << rsize) << "kB " << pow(2, rsize + 1) << " banks" << endl;
+	cout << "RAM Size: " << ram_size / 1024 << "kB " << (ram_size + 0x1FFF) / 0x2000 << " banks" << endl;
 	cout << "Destination Code: " << (buffer[0x014A] == 1 ? "Non-" : "") << "Japanese" << endl;
 }
 
 void Memory::save_state(ofstream &file)
 {
+	DIV.set(timer.div(now()));
+	TIMA.set(timer.tima(now()));
+
 	write_vector(file, VRAM);
 	write_vector(file, OAM);
 	write_vector(file, WRAM);
@@ -172,7 +293,7 @@ void Memory::save_state(ofstream &file)
 	// save ERAM
 	vector<Byte> eram = controller->get_ram();
 	write_vector(file, eram);
-	controller->save_state(file);
+	visit_controller([&file](auto& mbc) { mbc.save_state(file); });
 }
 
 void Memory::load_state(ifstream &file)
@@ -181,13 +302,17 @@ void Memory::load_state(ifstream &file)
 	load_vector(file, OAM);
 	load_vector(file, WRAM);
 	load_vector(file, ZRAM);
+	timer.load(now(), DIV.get(), TIMA.get(), TAC.get());
+	update_interrupts();
 
 	// Load ERAM
-	vector<Byte> eram(0x8000);
+	vector<Byte> eram = controller->get_ram();
 
 	load_vector(file, eram);
 	controller->set_ram(eram);
-	controller->load_state(file);
+	visit_controller([&file](auto& mbc) { mbc.load_state(file); });
+	dma_cycles = 0;
+	map_pages();
 }
 
 void Memory::write_vector(ofstream &file, vector<Byte> &vec)
@@ -200,16 +325,54 @@ void Memory::load_vector(ifstream &file, vector<Byte> &vec)
 	file.read((char*)&vec[0], vec.size());
 }
 
+// Copies 160 bytes to OAM at once and blocks the bus for the 640 cycles the transfer takes
 void Memory::do_dma_transfer()
 {
-	Byte_2 address = DMA.get() << 8; // multiply by 100
+	// a restarted transfer reads the source through the normal map again
+	if (dma_cycles > 0)
+	{
+		dma_cycles = 0;
+		map_pages();
+	}
+
+	Address source = DMA.get() << 8;
+	const Byte* page = read_pages[source >> 8];
+
+	if (page != nullptr)
+		memmove(&OAM[0], page, 0xA0);
+	else
+	{
+		// I/O, controller registers or disabled external RAM
+		for (int i = 0; i < 0xA0; i++)
+			OAM[i] = read_unmapped(source + i);
+	}
+
+	dma_cycles = 640;
+	block_bus();
+}
+
+// Leaves only the $FF00 - $FFFF page reachable, everything else goes through the handlers
+void Memory::block_bus()
+{
+	fill(begin(read_pages), end(read_pages), nullptr);
+	fill(begin(write_pages), end(write_pages), nullptr);
+}
 
-	for (int i = 0; i < 0xA0; i++)
+void Memory::advance(int cycles)
+{
+	if (dma_cycles > 0 && (dma_cycles -= cycles) <= 0)
 	{
-		write((0xFE00 + i), read(address + i));
+		dma_cycles = 0;
+		map_pages();
 	}
 }
 
+void Memory::timing_write()
+{
+	if (on_timing_write)
+		on_timing_write();
+}
+
 Byte Memory::get_joypad_state()
 {
 	Byte request = P1.get();
@@ -225,122 +388,58 @@ Byte Memory::get_joypad_state()
 	}
 }
 
-Byte Memory::read(Address location)
+// ROM bank currently mapped at the location
+int Memory::get_rom_bank(Address location)
 {
-	
-	switch (location & 0xF000)
-	{
-	// ROM
-	case 0x0000:
-	case 0x1000:
-	case 0x2000:
-	case 0x3000:
-	case 0x4000:
-	case 0x5000:
-	case 0x6000:
-	case 0x7000:
-		return controller->read(location);
-
-	// Graphics VRAM
-	case 0x8000:
-	case 0x9000:
-		return VRAM[location & 0x1FFF];
-
-	// External RAM
-	case 0xA000:
-	case 0xB000:
-		return controller->read(location);
-
-	// Working RAM (8kB) and RAM Shadow
-	case 0xC000:
-	case 0xD000:
-	case 0xE000:
-		return WRAM[location & 0x1FFF];
-
-	// Remaining Working RAM Shadow, I/O, Zero page RAM
-	case 0xF000:
-		switch (location & 0x0F00)
-		{
-			// Remaining Working RAM
-			case 0x000: case 0x100: case 0x200: case 0x300:
-			case 0x400: case 0x500: case 0x600: case 0x700:
-			case 0x800: case 0x900: case 0xA00: case 0xB00:
-			case 0xC00: case 0xD00:
-				return WRAM[location & 0x1FFF];
-
-			// Sprite OAM
-			case 0xE00:
-					return OAM[location & 0xFF];
-
-			case 0xF00:
-				if (location == 0xFF00)
-					return get_joypad_state();
-				else
-					return ZRAM[location & 0xFF];
-		}
-	default:
-		return 0xFF;
-	}
+	return controller->get_rom_bank(location);
 }
 
-void Memory::write(Address location, Byte data)
+// Reads from pages without storage mapped behind them
+Byte Memory::read_unmapped(Address location)
 {
-	switch (location & 0xF000)
-	{
-	// ROM
-	case 0x0000:
-	case 0x1000:
-	case 0x2000:
-	case 0x3000:
-	case 0x4000:
-	case 0x5000:
-	case 0x6000:
-	case 0x7000:
-		controller->write(location, data);
-		break;
+	// the bus is held by OAM DMA
+	if (dma_cycles > 0 && location < 0xFF00)
+		return 0xFF;
 
-	// Graphics VRAM
-	case 0x8000:
-	case 0x9000:
-		// Cannot write to VRAM during mode 3 
-		VRAM[location & 0x1FFF] = data;
-		break;
+	// Cartridge ROM and external RAM the controller did not map
+	if (location < 0x8000 || (location >= 0xA000 && location < 0xC000))
+		return visit_controller([location](auto& mbc) { return mbc.read(location); });
 
-	// External RAM
-	case 0xA000:
-	case 0xB000:
-		controller->write(location, data);
-		break;
+	// VRAM or OAM locked by the display
+	if (location < 0xFF00)
+		return 0xFF;
 
-	// Working RAM (8kB) and RAM Shadow
-	case 0xC000:
-	case 0xD000:
-	case 0xE000:
-		WRAM[location & 0x1FFF] = data;
-		break;
+	if (location == 0xFF00)
+		return get_joypad_state();
 
-	// Remaining Working RAM Shadow, I/O, Zero page RAM
-	case 0xF000:
-		switch (location & 0x0F00)
-		{
-		// Remaining Working RAM
-		case 0x000: case 0x100: case 0x200: case 0x300:
-		case 0x400: case 0x500: case 0x600: case 0x700:
-		case 0x800: case 0x900: case 0xA00: case 0xB00:
-		case 0xC00: case 0xD00:
-			WRAM[location & 0x1FFF] = data;
-			break;
+	if (location == 0xFF04)
+		return timer.div(now());
 
-		// Sprite OAM
-		case 0xE00:
-			OAM[location & 0xFF] = data;
-			break;
+	if (location == 0xFF05)
+		return timer.tima(now());
 
-		case 0xF00:
-			write_zero_page(location, data);
-			break;
-		}
+	return ZRAM[location & 0xFF];
+}
+
+void Memory::write_unmapped(Address location, Byte data)
+{
+	if (dma_cycles > 0 && location < 0xFF00)
+		return;
+
+	// ROM area writes go to the controller registers and may switch banks
+	if (location < 0x8000)
+	{
+		visit_controller([this, location, data](auto& mbc)
+		{
+			mbc.write(location, data);
+			mbc.map_pages(read_pages, write_pages);
+		});
+		controller_writes++;
 	}
+	else if (location >= 0xA000 && location < 0xC000)
+		visit_controller([location, data](auto& mbc) { mbc.write(location, data); });
+	else if (location >= 0xFF00)
+		write_zero_page(location, data);
 }
 
 void Memory::write_zero_page(Address location, Byte data)
@@ -353,19 +452,49 @@ void Memory::write_zero_page(Address location, Byte data)
 		break;
 	// Divider Register - Write as zero no matter content
 	case 0xFF04:
-		ZRAM[0x04] = 0;
+		timing_write();
+		timer.write_div(now());
+		break;
+	case 0xFF05:
+		timing_write();
+		timer.write_tima(now(), data);
+		break;
+	case 0xFF07:
+		timing_write();
+		timer.write_tac(now(), data);
+		ZRAM[0x07] = data;
+		break;
+	// IF and IE make up the pending interrupts
+	case 0xFF0F:
+	case 0xFFFF:
+		timing_write();
+		ZRAM[location & 0xFF] = data;
+		update_interrupts();
+		break;
+	// LYC only changes what happens at the next LCD update
+	case 0xFF45:
+		timing_write();
+		ZRAM[0x45] = data;
+		break;
+	// LCDC - turning the LCD on or off locks or frees VRAM and OAM
+	case 0xFF40:
+		ZRAM[0x40] = data;
+		map_video();
 		break;
-	// TODO: STAT - writing to match flag resets flag but doesn't change mode
+	// STAT - the mode and the LY=LYC flag are read only
 	case 0xFF41:
-		ZRAM[0x41] = (data & 0xFC) | (STAT.get() & 0x03);
+		timing_write();
+		ZRAM[0x41] = (data & 0xF8) | (STAT.get() & 0x07);
 		break;
 
 	// LY Register - Game cannot write to this register directly 
 	case 0xFF44:
+		timing_write();
 		ZRAM[0x44] = 0;
 		break;
 	// DMA transfer request
 	case 0xFF46:
+		timing_write();
 		ZRAM[0x46] = data;
 		do_dma_transfer();
 		break;
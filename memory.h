@@ -2,13 +2,30 @@
 
 #include "types.h"
 #include "memory_controllers.h"
+#include "timer.h"
 
 class Memory
 {
 private:
 
     //   
-    MemoryController* controller;
+    MemoryController* controller = nullptr;
+    ControllerType controller_type = MBC0;
+
+    // Calls visitor with the controller as its concrete class
+    template <class Visitor>
+    auto visit_controller(Visitor visitor) -> decltype(visitor(declval<MemoryController0&>()))
+    {
+        switch (controller_type)
+        {
+            case MBC1: return visitor(*static_cast<MemoryController1*>(controller));
+            case MBC2: return visitor(*static_cast<MemoryController2*>(controller));
+            case MBC3: return visitor(*static_cast<MemoryController3*>(controller));
+            case MBC5: return visitor(*static_cast<MemoryController5*>(controller));
+            case MMM01: return visitor(*static_cast<MemoryControllerMMM01*>(controller));
+            default:   return visitor(*static_cast<MemoryController0*>(controller));
+        }
+    }
 
     //  
     vector<Byte> VRAM;     // $8000 - $9FFF, 8kB 
@@ -16,7 +33,20 @@ private:
     vector<Byte> WRAM;     // $C000 - $DFFF, 8kB  
     vector<Byte> ZRAM;     // $FF80 - $FFFF, 128  
 
+    // Page tables, one entry per 256 byte page pointing straight at its storage.
+    // nullptr pages (I/O, controller registers, disabled ERAM) go through the handlers below
+    const Byte* read_pages[0x100];
+    Byte* write_pages[0x100];
+
+    void map_pages();
+    void map_video();
+    Byte read_unmapped(Address location);
+    void write_unmapped(Address location, Byte data);
+
     void do_dma_transfer();
+    void block_bus();
+    void timing_write();
+    unsigned long long now() const { return (clock != nullptr) ? *clock : 0; }
     Byte get_joypad_state();
 
 public:
@@ -28,23 +58,85 @@ public:
         BGP, OBP0, OBP1, WY, WX,
         IF, IE;
 
-    Byte video_mode;
+    // IF & IE, kept up to date by writes to either and by the emulator when it requests
+    // or services an interrupt, so checking for one is a single test
+    Byte pending_interrupts = 0;
+    void update_interrupts() { pending_interrupts = IF.get() & IE.get() & 0x1F; }
+
+    // DIV and TIMA, read and written through the timer rather than ZRAM
+    Timer timer;
+
+    Byte video_mode = 0;
+    void set_video_mode(Byte mode);
+
+    // Cycles left of the OAM DMA window, the CPU only reaches $FF00 - $FFFF meanwhile
+    int dma_cycles = 0;
+
+    // Master clock (Scheduler::now), the time base of the cartridge RTC
+    const unsigned long long* clock = nullptr;
+    // Run the cartridge RTC from the host clock instead, so it keeps time while the emulator is closed
+    bool rtc_host_time = false;
+    // Keep battery backed cartridge RAM in a .sav file next to the ROM
+    bool battery_saves = true;
+
+    // Called with the cycles emulated since the last call, ends the DMA window
+    void advance(int cycles);
+
+    // Called before writes to the registers the scheduled timer, LCD and interrupt events
+    // depend on (DIV, TIMA, TAC, IF, STAT, LY, LYC, DMA, IE), so everything is brought up to date first
+    function<void()> on_timing_write;
+
     Byte joypad_buttons;
     Byte joypad_arrows;
 
     string rom_name;
 
+    // Incremented on every write to the memory controller registers (bank switches)
+    unsigned int controller_writes = 0;
+    int get_rom_bank(Address location);
+
     Memory();
+    ~Memory();
     void reset();
     void load_rom(std::string location);
 
-    Byte read(Address location);
+    // Plain RAM and ROM reads are a page table load plus an index
+    Byte read(Address location)
+    {
+        const Byte* page = read_pages[location >> 8];
+
+        if (page != nullptr)
+            return page[location & 0xFF];
+
+        return read_unmapped(location);
+    }
+
+    // Instruction stream reads
+    Byte fetch(Address location)
+    {
+        return read(location);
+    }
+
+    // Reads of VRAM and OAM by the display, which never sees the CPU bus blocked
+    Byte read_video(Address location)
+    {
+        return (location < 0xA000) ? VRAM[location & 0x1FFF] : OAM[location & 0xFF];
+    }
 
     void write_vector(ofstream& file, vector<Byte>& vec);
     void load_vector(ifstream& file, vector<Byte>& vec);
     void save_state(ofstream& file);
     void load_state(ifstream& file);
 
-    void write(Address location, Byte data);
+    void write(Address location, Byte data)
+    {
+        Byte* page = write_pages[location >> 8];
+
+        if (page != nullptr)
+            page[location & 0xFF] = data;
+        else
+            write_unmapped(location, data);
+    }
+
     void write_zero_page(Address location, Byte data);
 };
@@ -1,19 +1,103 @@
 #include "memory_controllers.h"
 
-void MemoryController::init(vector<Byte> cartridge_buffer)
+#include <chrono>
+
+void MemoryController::init(shared_ptr<const RomImage> image, size_t ram_size)
+{
+	rom = image;
+	CART_ROM = rom->data();
+	ram_storage = vector<Byte>(ram_size);
+	ERAM = ram_storage.data();
+	ERAM_size = ram_size;
+
+	// ROM sizes are powers of two, the mask drops the bank lines a smaller cartridge leaves unconnected
+	rom_banks = max((int)(rom->size() / 0x4000), 1);
+
+	for (rom_bank_mask = 1; rom_bank_mask < rom_banks; rom_bank_mask <<= 1);
+	rom_bank_mask--;
+	ram_bank_mask = max((int)(ram_size / 0x2000), 1) - 1;
+
+	select_banks(0, 1, 0, false);
+}
+
+// ROM bank currently mapped at the location, bank 0 area or $4000 - $7FFF
+int MemoryController::get_rom_bank(Address location)
+{
+	return (location < 0x4000) ? rom_bank0 : rom_bank;
+}
+
+// Called by every controller when its bank registers change
+void MemoryController::select_banks(int bank0, int bank, int ram, bool ram_enabled)
+{
+	rom_bank0 = (bank0 & rom_bank_mask) % rom_banks;
+	rom_bank = (bank & rom_bank_mask) % rom_banks;
+	ram_bank = ram & ram_bank_mask;
+
+	rom_bank0_base = &CART_ROM[rom_bank0 * 0x4000];
+	rom_bank_base = &CART_ROM[rom_bank * 0x4000];
+	ram_bank_base = (ram_enabled) ? &ERAM[ram_bank * 0x2000] : nullptr;
+}
+
+// RAM enable register, only 0x0A in the lower 4 bits enables. Games disable RAM again
+// once their save is written, which is when the battery file is flushed
+void MemoryController::enable_ram(Byte data)
+{
+	bool enabled = ((data & 0x0F) == 0x0A);
+
+	if (RAM_access_enabled && !enabled && battery)
+		battery->flush();
+
+	RAM_access_enabled = enabled;
+}
+
+// Moves ERAM into the .sav file at path. The file keeps the RAM it already holds,
+// the rest of it starts out as the current contents. extra bytes follow the RAM
+bool MemoryController::attach_battery(const string& path, size_t extra)
+{
+	battery = SaveRam::open(path, ERAM_size + extra);
+
+	if (!battery)
+		return false;
+
+	Byte* storage = battery->data();
+
+	if (battery->existing() < ERAM_size)
+		copy(ERAM + battery->existing(), ERAM + ERAM_size, storage + battery->existing());
+
+	if (ram_bank_base != nullptr)
+		ram_bank_base = storage + (ram_bank_base - ERAM);
+
+	ERAM = storage;
+	ram_storage.clear();
+	return true;
+}
+
+// Reads of the pages map_pages() left unmapped, only disabled RAM for most controllers
+Byte MemoryController::read(Address location)
 {
-	CART_ROM = cartridge_buffer;
-	ERAM = vector<Byte>(0x8000); // $A000 - $BFFF, 8kB switchable RAM bank, size liable to change in future
+	return (location < 0x8000) ? read_rom(location) : read_ram(location);
+}
+
+void MemoryController::map_pages(const Byte* read_pages[], Byte* write_pages[])
+{
+	for (int i = 0; i < 0x40; i++)
+	{
+		read_pages[i] = rom_bank0_base + i * 0x100;
+		read_pages[0x40 + i] = rom_bank_base + i * 0x100;
+	}
+
+	for (int i = 0; i < 0x20; i++)
+		read_pages[0xA0 + i] = write_pages[0xA0 + i] = (ram_bank_base != nullptr) ? ram_bank_base + i * 0x100 : nullptr;
 }
 
 vector<Byte> MemoryController::get_ram()
 {
-	return ERAM;
+	return vector<Byte>(ERAM, ERAM + ERAM_size);
 }
 
 void MemoryController::set_ram(vector<Byte> data)
 {
-	ERAM = data;
+	copy_n(data.begin(), min(data.size(), ERAM_size), ERAM);
 }
 
 void MemoryController::save_state(ofstream &file) {
@@ -27,57 +111,25 @@ void MemoryController::load_state(ifstream &file) {
 	MC0 represents games that use exactly 32kB of space
 	and don't have memory controllers
 */
-Byte MemoryController0::read(Address location)
+void MemoryController0::init(shared_ptr<const RomImage> image, size_t ram_size)
 {
-	if (location >= 0x0000 && location <= 0x7FFF)
-		return CART_ROM[location];
-	else if (location >= 0xA000 && location <= 0xBFFF)
-		return ERAM[location & 0x1FFF];
-	else
-		return 0x00;
+	MemoryController::init(image, ram_size);
+	select_banks(0, 1, 0, true);
 }
 
 void MemoryController0::write(Address location, Byte data)
 {
 	if (location >= 0xA000 && location <= 0xBFFF)
-		ERAM[location & 0x1FFF] = data;
+		write_ram(location, data);
 }
 
 /*
 	Memory Controller 1
 */
-Byte MemoryController1::read(Address location)
+void MemoryController1::init(shared_ptr<const RomImage> image, size_t ram_size)
 {
-	// ROM bank 0 (read only)
-	if (location >= 0x0000 && location <= 0x3FFF)
-	{
-		return CART_ROM[location];
-	}
-	// ROM banks 01-7F (read only)
-	else if (location >= 0x4000 && location <= 0x7FFF)
-	{
-		// only ROM banks 0x00 - 0x1F can be used during mode 1
-		Byte temp_id = ROM_bank_id;
-
-		int offset = location - 0x4000;
-		int lookup = (temp_id * 0x4000) + offset;
-
-		return CART_ROM[lookup];
-	}
-	// RAM banks 00 - 03, if any (read/write)
-	else if (location >= 0xA000 && location <= 0xBFFF)
-	{
-		if (RAM_access_enabled == false)
-			return 0xFF;
-
-		// only RAM bank 0 can be used during ROM mode
-		Byte temp_id = (RAM_bank_enabled) ? RAM_bank_id : 0x00;
-
-		int offset = location - 0xA000;
-		int lookup = (temp_id * 0x2000) + offset;
-
-		return ERAM[lookup];
-	}
+	MemoryController::init(image, ram_size);
+	update_banks();
 }
 
 void MemoryController1::write(Address location, Byte data)
@@ -85,56 +137,23 @@ void MemoryController1::write(Address location, Byte data)
 	// RAM enable (write only)
 	if (location >= 0x0000 && location <= 0x1FFF)
 	{
-		// Any value with 0x0A in lower 4 bits enables, everything else disables
-		RAM_access_enabled = ((data & 0x0A) > 0) ? true : false;
+		// Only 0x0A in the lower 4 bits enables, everything else disables
+		enable_ram(data);
 	}
 	// ROM bank id low bits select (write only)
 	else if (location >= 0x2000 && location <= 0x3FFF)
 	{
-		// bottom 5 bits represent bank number from 0x00 -> 0x1F
-		Byte bank_id = data & 0x1F;
-
-		ROM_bank_id = (ROM_bank_id & 0xE0) | bank_id;
+		// bottom 5 bits represent bank number from 0x00 -> 0x1F,
+		// zero selects bank 1 (so banks 0x20, 0x40 and 0x60 can't be reached either)
+		ROM_bank_id = data & 0x1F;
 
-		// Prevent bank zero from being accessed
-		// TODO: may need to adjust this to include other banks
-		switch (ROM_bank_id)
-		{
-			case 0x00:
-			case 0x20:
-			case 0x40:
-			case 0x60:
-				ROM_bank_id++;
-				break;
-		}
+		if (ROM_bank_id == 0)
+			ROM_bank_id++;
 	}
 	// RAM bank id, or upper bits of ROM bank id
 	else if (location >= 0x4000 && location <= 0x5FFF)
 	{
-		// extract bottom 2 bits
-		Byte bank_id = data & 0x03;
-
-		// data represents RAM bank ID
-		if (RAM_bank_enabled)
-		{
-			RAM_bank_id = bank_id;
-		}
-		// data represents top bits of ROM bank ID
-		else
-		{
-			ROM_bank_id = ROM_bank_id | (bank_id << 5);
-
-			// Adjust bank ID to prevent certain banks from being accessed
-			switch (ROM_bank_id)
-			{
-				case 0x00:
-				case 0x20:
-				case 0x40:
-				case 0x60:
-					ROM_bank_id++;
-					break;
-			}
-		}
+		RAM_bank_id = data & 0x03;
 	}
 	// Bank selector
 	else if (location >= 0x6000 && location <= 0x7FFF)
@@ -144,14 +163,24 @@ void MemoryController1::write(Address location, Byte data)
 	// RAM banks 00 - 03, if any (read/write)
 	else if (location >= 0xA000 && location <= 0xBFFF)
 	{
-		if (RAM_access_enabled)
-		{
-			int offset = location - 0xA000;
-			int lookup = (RAM_bank_id * 0x2000) + offset;
-
-			ERAM[lookup] = data;
-		}
+		write_ram(location, data);
+		return;
 	}
+
+	update_banks();
+}
+
+void MemoryController1::update_banks()
+{
+	// the 2 bit register is always the upper bits of the $4000 - $7FFF bank, in RAM banking mode
+	// it also selects the $0000 - $3FFF bank and the RAM bank, otherwise both are bank 0
+	int upper_bits = RAM_bank_id << 5;
+	int bank = upper_bits | (ROM_bank_id & 0x1F);
+
+	if (RAM_bank_enabled)
+		select_banks(upper_bits, bank, RAM_bank_id, RAM_access_enabled);
+	else
+		select_banks(0, bank, 0, RAM_access_enabled);
 }
 
 void MemoryController1::save_state(ofstream &file)
@@ -172,68 +201,148 @@ void MemoryController1::load_state(ifstream &file)
 	file.read((char*)&RAM_bank_enabled, sizeof(RAM_bank_enabled));
 	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.read((char*)&mode, sizeof(mode));
+	update_banks();
 	cout << "read registers" << endl;
 }
 
 /*
 	Memory Controller 2
 */
-Byte MemoryController2::read(Address location) { return 0; }
-void MemoryController2::write(Address location, Byte data) {}
+// The header's RAM size is ignored, MBC2 always has its own 512 x 4 bits
+void MemoryController2::init(shared_ptr<const RomImage> image, size_t)
+{
+	// 512 half bytes, kept with the upper 4 bits set the way they read back
+	MemoryController::init(image, 0x200);
+	fill(ERAM, ERAM + ERAM_size, 0xFF);
+	update_banks();
+}
 
-/*
-	Memory Controller 3
-*/
-Byte MemoryController3::read(Address location)
+Byte MemoryController2::read(Address location)
+{
+	if (location >= 0xA000 && location <= 0xBFFF)
+		return (RAM_access_enabled) ? ERAM[location & 0x1FF] : 0xFF;
+
+	return read_rom(location);
+}
+
+void MemoryController2::write(Address location, Byte data)
 {
-	// ROM bank 0 (read only)
 	if (location >= 0x0000 && location <= 0x3FFF)
 	{
-		return CART_ROM[location];
-	}
-	// ROM banks 01-7F (read only)
-	else if (location >= 0x4000 && location <= 0x7FFF)
-	{
-		int offset = location - 0x4000;
-		int lookup = (ROM_bank_id * 0x4000) + offset;
+		// Bit 8 of the address tells the ROM bank register from RAM enable
+		if (location & 0x0100)
+		{
+			ROM_bank_id = data & 0x0F;
 
-		return CART_ROM[lookup];
+			if (ROM_bank_id == 0)
+				ROM_bank_id++;
+		}
+		else
+			enable_ram(data);
+
+		update_banks();
 	}
-	// RAM banks 00 - 03, if any (read/write)
 	else if (location >= 0xA000 && location <= 0xBFFF)
 	{
-		if (RTC_enabled)
-			return 0x00;
+		if (RAM_access_enabled)
+			ERAM[location & 0x1FF] = data | 0xF0;
+	}
+}
 
-		if (RAM_access_enabled == false)
-			return 0xFF;
+void MemoryController2::update_banks()
+{
+	select_banks(0, ROM_bank_id, 0, false);
+}
 
-		int offset = location - 0xA000;
-		int lookup = (RAM_bank_id * 0x2000) + offset;
+void MemoryController2::map_pages(const Byte* read_pages[], Byte* write_pages[])
+{
+	MemoryController::map_pages(read_pages, write_pages);
 
-		return ERAM[lookup];
-	}
+	// the 512 bytes repeat over $A000 - $BFFF. Writes go through write() to set the upper bits
+	for (int i = 0; i < 0x20; i++)
+		read_pages[0xA0 + i] = (RAM_access_enabled) ? &ERAM[(i & 1) * 0x100] : nullptr;
+}
+
+void MemoryController2::save_state(ofstream &file)
+{
+	file.write((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	cout << "wrote registers" << endl;
+}
+
+void MemoryController2::load_state(ifstream &file)
+{
+	file.read((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	update_banks();
+	cout << "read registers" << endl;
+}
+
+/*
+	Memory Controller 3
+*/
+void MemoryController3::init(shared_ptr<const RomImage> image, size_t ram_size)
+{
+	MemoryController::init(image, ram_size);
+	update_banks();
+}
+
+MemoryController3::~MemoryController3()
+{
+	if (battery)
+		save_rtc(ERAM + ERAM_size);
+}
+
+// The clock state is kept in the .sav file after the RAM
+bool MemoryController3::attach_battery(const string& path)
+{
+	if (!MemoryController::attach_battery(path, RTC_SAVE_SIZE))
+		return false;
+
+	if (battery->existing() >= ERAM_size + RTC_SAVE_SIZE)
+		load_rtc(ERAM + ERAM_size);
+
+	return true;
+}
+
+// Writes the clock next to the RAM before the file is flushed
+void MemoryController3::enable_ram(Byte data)
+{
+	if (battery)
+		save_rtc(ERAM + ERAM_size);
+
+	MemoryController::enable_ram(data);
+}
+
+// Points the clock at the emulated cycle count, or the host clock when use_host_time is set
+void MemoryController3::set_clock(const unsigned long long* cycles, bool use_host_time)
+{
+	long long counter = rtc_counter();
+
+	clock = cycles;
+	host_time = use_host_time;
+	set_rtc_counter(counter);
+}
+
+Byte MemoryController3::read(Address location)
+{
+	// latched RTC register
+	if (location >= 0xA000 && location <= 0xBFFF && RTC_enabled)
+		return (RAM_access_enabled) ? RTC_latched[RTC_register - 0x08] : 0xFF;
+
+	return MemoryController::read(location);
 }
 
 void MemoryController3::write(Address location, Byte data)
 {
 	if (location >= 0x0000 && location <= 0x1FFF)
 	{
-		// Any value with 0x0A in lower 4 bits enables, everything else disables
-		if ((data & 0x0A) > 0)
-		{
-			RAM_access_enabled = true;
-			RTC_enabled = true;
-		}
-		else
-		{
-			RAM_access_enabled = false;
-			RTC_enabled = false;
-		}
+		// Only 0x0A in the lower 4 bits enables RAM and RTC, everything else disables
+		enable_ram(data);
 	}
 	else if (location >= 0x2000 && location <= 0x3FFF)
 	{
-		// bits 0-6 bits represent bank number from 0x00 -> 0x1F
+		// bits 0-6 bits represent bank number from 0x00 -> 0x7F
 		ROM_bank_id = data & 0x7F;
 
 		if (ROM_bank_id == 0)
@@ -251,30 +360,153 @@ void MemoryController3::write(Address location, Byte data)
 		else if (data >= 0x08 && data <= 0x0C)
 		{
 			RTC_enabled = true;
+			RTC_register = data;
 		}
 	}
 	else if (location >= 0x6000 && location <= 0x7FFF)
 	{
-		// TODO: Latch clock data
+		// Latch clock data
+		if (RTC_latch == 0x00 && data == 0x01)
+			get_rtc_registers(RTC_latched);
+
+		RTC_latch = data;
+		return;
 	}
 	else if (location >= 0xA000 && location <= 0xBFFF)
 	{
 		// writing to RAM
 		if (!RTC_enabled)
-		{
-			if (!RAM_access_enabled)
-				return;
+			write_ram(location, data);
+		else if (RAM_access_enabled)
+			write_rtc(data);
+		return;
+	}
 
-			int offset = location - 0xA000;
-			int lookup = (RAM_bank_id * 0x2000) + offset;
+	update_banks();
+}
 
-			ERAM[lookup] = data;
-		}
-		else
-		{
-			// TODO: RTC writing
-		}
+long long MemoryController3::rtc_now()
+{
+	if (!host_time)
+		return (clock != nullptr) ? (long long)*clock : 0;
+
+	long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	return (ms / 1000) * RTC_CYCLES_PER_SECOND + (ms % 1000) * RTC_CYCLES_PER_SECOND / 1000;
+}
+
+// Cycles on the clock, days wrap at 512 and set the carry flag
+long long MemoryController3::rtc_counter()
+{
+	long long counter = (RTC_halted) ? RTC_halted_counter : rtc_now() - RTC_base;
+	long long wrap = 512 * RTC_DAY * RTC_CYCLES_PER_SECOND;
+
+	if (counter >= wrap)
+	{
+		RTC_carry = true;
+		counter %= wrap;
+		set_rtc_counter(counter);
+	}
+
+	return counter;
+}
+
+void MemoryController3::set_rtc_counter(long long counter)
+{
+	if (RTC_halted)
+		RTC_halted_counter = counter;
+	else
+		RTC_base = rtc_now() - counter;
+}
+
+void MemoryController3::get_rtc_registers(Byte registers[])
+{
+	long long seconds = rtc_counter() / RTC_CYCLES_PER_SECOND;
+	long long days = seconds / RTC_DAY;
+
+	registers[0] = seconds % 60;
+	registers[1] = (seconds / 60) % 60;
+	registers[2] = (seconds / 3600) % 24;
+	registers[3] = days & 0xFF;
+	registers[4] = ((days >> 8) & 0x01) | (RTC_halted ? 0x40 : 0) | (RTC_carry ? 0x80 : 0);
+}
+
+// Changes one field of the running clock, the others keep counting from where they are
+void MemoryController3::write_rtc(Byte data)
+{
+	long long counter = rtc_counter();
+	long long fraction = counter % RTC_CYCLES_PER_SECOND;
+	long long seconds = counter / RTC_CYCLES_PER_SECOND;
+
+	long long second = seconds % 60;
+	long long minute = (seconds / 60) % 60;
+	long long hour = (seconds / 3600) % 24;
+	long long day = seconds / RTC_DAY;
+
+	switch (RTC_register)
+	{
+		// writing the seconds also restarts the current second
+		case 0x08: second = data & 0x3F; fraction = 0; break;
+		case 0x09: minute = data & 0x3F; break;
+		case 0x0A: hour = data & 0x1F; break;
+		case 0x0B: day = (day & 0x100) | data; break;
+		case 0x0C:
+			day = (day & 0xFF) | ((data & 0x01) << 8);
+			RTC_halted = is_bit_set(data, BIT_6);
+			RTC_carry = is_bit_set(data, BIT_7);
+			break;
+	}
+
+	set_rtc_counter((second + minute * 60 + hour * 3600 + day * RTC_DAY) * RTC_CYCLES_PER_SECOND + fraction);
+	RTC_latched[RTC_register - 0x08] = data;
+}
+
+// Running and latched registers, 4 bytes each, then the host time in seconds, 8 bytes, little endian
+void MemoryController3::save_rtc(Byte data[])
+{
+	Byte registers[5];
+	get_rtc_registers(registers);
+
+	long long timestamp = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+	fill(data, data + RTC_SAVE_SIZE, 0);
+
+	for (int i = 0; i < 5; i++)
+	{
+		data[i * 4] = registers[i];
+		data[20 + i * 4] = RTC_latched[i];
+	}
+
+	for (int i = 0; i < 8; i++)
+		data[40 + i] = (Byte)(timestamp >> (i * 8));
+}
+
+void MemoryController3::load_rtc(const Byte data[])
+{
+	long long timestamp = 0;
+
+	for (int i = 0; i < 8; i++)
+		timestamp |= (long long)data[40 + i] << (i * 8);
+
+	for (int i = 0; i < 5; i++)
+		RTC_latched[i] = data[20 + i * 4];
+
+	long long seconds = data[0] + data[4] * 60 + data[8] * 3600 + (data[12] | ((data[16] & 0x01) << 8)) * RTC_DAY;
+	RTC_halted = is_bit_set(data[16], BIT_6);
+	RTC_carry = is_bit_set(data[16], BIT_7);
+
+	// on the host clock the time spent closed has passed as well
+	if (host_time && !RTC_halted)
+	{
+		long long now = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+		seconds += max(now - timestamp, 0LL);
 	}
+
+	set_rtc_counter(seconds * RTC_CYCLES_PER_SECOND);
+}
+
+void MemoryController3::update_banks()
+{
+	// RTC registers are read and written through read() / write()
+	select_banks(0, ROM_bank_id, RAM_bank_id, RAM_access_enabled && !RTC_enabled);
 }
 
 void MemoryController3::save_state(ofstream &file)
@@ -285,6 +517,12 @@ void MemoryController3::save_state(ofstream &file)
 	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.write((char*)&mode, sizeof(mode));
 	file.write((char*)&RTC_enabled, sizeof(RTC_enabled));
+	file.write((char*)&RTC_register, sizeof(RTC_register));
+	file.write((char*)&RTC_latch, sizeof(RTC_latch));
+
+	Byte rtc[RTC_SAVE_SIZE];
+	save_rtc(rtc);
+	file.write((char*)rtc, RTC_SAVE_SIZE);
 	cout << "wrote registers" << endl;
 }
 
@@ -296,5 +534,156 @@ void MemoryController3::load_state(ifstream &file)
 	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.read((char*)&mode, sizeof(mode));
 	file.read((char*)&RTC_enabled, sizeof(RTC_enabled));
+	file.read((char*)&RTC_register, sizeof(RTC_register));
+	file.read((char*)&RTC_latch, sizeof(RTC_latch));
+
+	Byte rtc[RTC_SAVE_SIZE];
+	file.read((char*)rtc, RTC_SAVE_SIZE);
+	load_rtc(rtc);
+	update_banks();
 	cout << "read registers" << endl;
-}
\ No newline at end of file
+}
+
+/*
+	Memory Controller 5
+*/
+void MemoryController5::init(shared_ptr<const RomImage> image, size_t ram_size)
+{
+	MemoryController::init(image, ram_size);
+	update_banks();
+}
+
+void MemoryController5::write(Address location, Byte data)
+{
+	if (location <= 0x1FFF)
+	{
+		enable_ram(data);
+	}
+	// low 8 bits of the ROM bank, unlike MBC1 bank 0 can be selected here
+	else if (location >= 0x2000 && location <= 0x2FFF)
+	{
+		ROM_bank_id = data;
+	}
+	else if (location >= 0x3000 && location <= 0x3FFF)
+	{
+		ROM_bank_high = data & 0x01;
+	}
+	// RAM banks 00 - 0F
+	else if (location >= 0x4000 && location <= 0x5FFF)
+	{
+		RAM_bank_id = data & 0x0F;
+	}
+	else if (location >= 0xA000 && location <= 0xBFFF)
+	{
+		write_ram(location, data);
+		return;
+	}
+
+	update_banks();
+}
+
+void MemoryController5::update_banks()
+{
+	select_banks(0, (ROM_bank_high << 8) | ROM_bank_id, RAM_bank_id, RAM_access_enabled);
+}
+
+void MemoryController5::save_state(ofstream &file)
+{
+	file.write((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.write((char*)&ROM_bank_high, sizeof(ROM_bank_high));
+	file.write((char*)&RAM_bank_id, sizeof(RAM_bank_id));
+	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	cout << "wrote registers" << endl;
+}
+
+void MemoryController5::load_state(ifstream &file)
+{
+	file.read((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.read((char*)&ROM_bank_high, sizeof(ROM_bank_high));
+	file.read((char*)&RAM_bank_id, sizeof(RAM_bank_id));
+	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	update_banks();
+	cout << "read registers" << endl;
+}
+
+/*
+	MMM01
+
+	Starts with the menu in the last 32kB mapped at $0000 - $7FFF. The menu writes the first
+	bank of the game to the ROM bank register and sets bit 6 of the RAM enable register,
+	after that the game sees an MBC1 over its own part of the ROM until power off
+*/
+void MemoryControllerMMM01::init(shared_ptr<const RomImage> image, size_t ram_size)
+{
+	MemoryController::init(image, ram_size);
+	update_banks();
+}
+
+void MemoryControllerMMM01::write(Address location, Byte data)
+{
+	if (location <= 0x1FFF)
+	{
+		enable_ram(data);
+
+		if (is_bit_set(data, BIT_6))
+			mapped = true;
+	}
+	else if (location >= 0x2000 && location <= 0x3FFF)
+	{
+		if (!mapped)
+			ROM_bank_base = data;
+		else
+		{
+			ROM_bank_id = data & 0x1F;
+
+			if (ROM_bank_id == 0)
+				ROM_bank_id++;
+		}
+	}
+	else if (location >= 0x4000 && location <= 0x5FFF)
+	{
+		RAM_bank_id = data & 0x03;
+	}
+	else if (location >= 0x6000 && location <= 0x7FFF)
+	{
+		RAM_bank_enabled = is_bit_set(data, BIT_0);
+	}
+	else if (location >= 0xA000 && location <= 0xBFFF)
+	{
+		write_ram(location, data);
+		return;
+	}
+
+	update_banks();
+}
+
+void MemoryControllerMMM01::update_banks()
+{
+	if (!mapped)
+		select_banks(rom_banks - 2, rom_banks - 1, 0, RAM_access_enabled);
+	else
+		select_banks(ROM_bank_base, ROM_bank_base + ROM_bank_id, (RAM_bank_enabled) ? RAM_bank_id : 0, RAM_access_enabled);
+}
+
+void MemoryControllerMMM01::save_state(ofstream &file)
+{
+	file.write((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.write((char*)&RAM_bank_id, sizeof(RAM_bank_id));
+	file.write((char*)&RAM_bank_enabled, sizeof(RAM_bank_enabled));
+	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	file.write((char*)&mapped, sizeof(mapped));
+	file.write((char*)&ROM_bank_base, sizeof(ROM_bank_base));
+	cout << "wrote registers" << endl;
+}
+
+void MemoryControllerMMM01::load_state(ifstream &file)
+{
+	file.read((char*)&ROM_bank_id, sizeof(ROM_bank_id));
+	file.read((char*)&RAM_bank_id, sizeof(RAM_bank_id));
+	file.read((char*)&RAM_bank_enabled, sizeof(RAM_bank_enabled));
+	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
+	file.read((char*)&mapped, sizeof(mapped));
+	file.read((char*)&ROM_bank_base, sizeof(ROM_bank_base));
+	update_banks();
+	cout << "read registers" << endl;
+}
@@ -1,15 +1,29 @@
 #pragma once
 
 #include "types.h"
+#include "rom_image.h"
+#include "save_ram.h"
 
-// Abstract class that each memory controller must represent
+// Cartridge controller types. Memory keeps the type next to the controller and dispatches
+// to the concrete class through a switch on it (see Memory::visit_controller), so controller
+// calls are direct calls instead of virtual ones
+enum ControllerType { MBC0, MBC1, MBC2, MBC3, MBC5, MMM01 };
+
+// State and helpers shared by the memory controllers. Each controller keeps its bank registers
+// as the game wrote them and turns them into the banks below in its update_banks(). It defines
+// its own write() and may replace read(), map_pages() and the save state functions
 class MemoryController
 {
 	protected:
-		// $0000 - $7FFF, 32kB Cartridge (potentially dynamic)
-		vector<Byte> CART_ROM;
-		// $A000 - $BFFF, 8kB Cartridge external switchable RAM bank
-		vector<Byte> ERAM;
+		// $0000 - $7FFF, 32kB Cartridge (potentially dynamic), the ROM image shared with other instances
+		shared_ptr<const RomImage> rom;
+		const Byte* CART_ROM = nullptr;
+		// $A000 - $BFFF, 8kB Cartridge external switchable RAM banks, sized from the header.
+		// Battery backed RAM lives in the mapped .sav file, other RAM in ram_storage
+		Byte* ERAM = nullptr;
+		size_t ERAM_size = 0;
+		vector<Byte> ram_storage;
+		unique_ptr<SaveRam> battery;
 
 		// Bank selectors
 		Byte ROM_bank_id = 1;
@@ -23,27 +37,68 @@ class MemoryController
 		const Byte MODE_ROM = 0;
 		const Byte MODE_RAM = 1;
 
+		// Banks mapped right now, masked to the size of the cartridge. They only change in
+		// select_banks(), so banked reads are a base pointer plus an offset like unbanked ones
+		int rom_banks = 1;
+		int rom_bank_mask = 0;
+		int ram_bank_mask = 0;
+		int rom_bank0 = 0;
+		int rom_bank = 1;
+		int ram_bank = 0;
+		const Byte* rom_bank0_base = nullptr; // $0000 - $3FFF
+		const Byte* rom_bank_base = nullptr;  // $4000 - $7FFF
+		Byte* ram_bank_base = nullptr;        // $A000 - $BFFF, nullptr while RAM is disabled
+
+		void select_banks(int bank0, int bank, int ram, bool ram_enabled);
+		void enable_ram(Byte data);
+
+		Byte read_rom(Address location)
+		{
+			return ((location < 0x4000) ? rom_bank0_base : rom_bank_base)[location & 0x3FFF];
+		}
+
+		Byte read_ram(Address location)
+		{
+			return (ram_bank_base != nullptr) ? ram_bank_base[location & 0x1FFF] : 0xFF;
+		}
+
+		void write_ram(Address location, Byte data)
+		{
+			if (ram_bank_base != nullptr)
+				ram_bank_base[location & 0x1FFF] = data;
+		}
+
 	public:
-		void init(vector<Byte> cartridge_buffer);
-		virtual Byte read(Address location) = 0;
-		virtual void write(Address location, Byte data) = 0;
+		void init(shared_ptr<const RomImage> image, size_t ram_size);
+		bool attach_battery(const string& path, size_t extra = 0);
+		int get_rom_bank(Address location);
+		Byte read(Address location);
+
+		// Points the $0000 - $7FFF and $A000 - $BFFF pages of the Memory page tables at the
+		// banks selected right now. Pages left nullptr go through read() / write()
+		void map_pages(const Byte* read_pages[], Byte* write_pages[]);
 
 		// Save states
 		vector<Byte> get_ram();
 		void set_ram(vector<Byte> data);
-		virtual void save_state(ofstream &file);
-		virtual void load_state(ifstream &file);
+		void save_state(ofstream &file);
+		void load_state(ifstream &file);
 };
 
 // This class represents games that only use the exact 32kB of cartridge space
 class MemoryController0 : public MemoryController {
-	Byte read(Address location);
+public:
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
 	void write(Address location, Byte data);
 };
 
 // MBC1 (max 2MByte ROM and/or 32KByte RAM)
 class MemoryController1 : public MemoryController {
-	Byte read(Address location);
+
+	void update_banks();
+
+public:
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
 	void write(Address location, Byte data);
 	void save_state(ofstream &file);
 	void load_state(ifstream &file);
@@ -51,16 +106,90 @@ class MemoryController1 : public MemoryController {
 
 // MBC2 (max 256KByte ROM and 512x4 bits RAM)
 class MemoryController2 : public MemoryController {
+
+	void update_banks();
+
+public:
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
 	Byte read(Address location);
 	void write(Address location, Byte data);
+	void map_pages(const Byte* read_pages[], Byte* write_pages[]);
+	void save_state(ofstream &file);
+	void load_state(ifstream &file);
 };
 
 // MBC3(max 2MByte ROM and / or 32KByte RAM and Timer)
 class MemoryController3 : public MemoryController {
-	
+
+	// An RTC register is selected in place of a RAM bank
 	bool RTC_enabled = false;
 
-	Byte read(Address locatison);
+	// The real time clock is kept as the time it read zero at, in cycles, and only turned
+	// into seconds, minutes, hours and days when the game latches or writes it
+	static const long long RTC_CYCLES_PER_SECOND = 4194304;
+	static const long long RTC_DAY = 86400;
+
+	const unsigned long long* clock = nullptr; // Scheduler::now
+	bool host_time = false;
+
+	Byte RTC_register = 0x08;    // $08 - $0C, seconds, minutes, hours, days low, days high
+	Byte RTC_latch = 0xFF;       // last value written to $6000 - $7FFF, $00 then $01 latches
+	Byte RTC_latched[5] = {};
+	long long RTC_base = 0;      // rtc_now() when the counter was zero
+	long long RTC_halted_counter = 0;
+	bool RTC_halted = false;
+	bool RTC_carry = false;      // day counter overflowed
+
+	long long rtc_now();
+	long long rtc_counter();
+	void set_rtc_counter(long long counter);
+	void get_rtc_registers(Byte registers[]);
+	void write_rtc(Byte data);
+
+	void enable_ram(Byte data);
+	void update_banks();
+
+public:
+	// Size of the clock state save_rtc() writes, the block other emulators append to .sav files
+	static const int RTC_SAVE_SIZE = 48;
+
+	~MemoryController3();
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
+	bool attach_battery(const string& path);
+	void set_clock(const unsigned long long* cycles, bool use_host_time);
+	Byte read(Address location);
+	void write(Address location, Byte data);
+	void save_rtc(Byte data[]);
+	void load_rtc(const Byte data[]);
+	void save_state(ofstream &file);
+	void load_state(ifstream &file);
+};
+
+// MBC5 (max 8MByte ROM and/or 128KByte RAM)
+class MemoryController5 : public MemoryController {
+
+	// 9th bit of the ROM bank
+	Byte ROM_bank_high = 0;
+
+	void update_banks();
+
+public:
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
+	void write(Address location, Byte data);
+	void save_state(ofstream &file);
+	void load_state(ifstream &file);
+};
+
+// MMM01 multicarts, a menu in the last 32kB that maps one of the games and locks the mapping
+class MemoryControllerMMM01 : public MemoryController {
+
+	bool mapped = false;
+	Byte ROM_bank_base = 0; // first bank of the selected game
+
+	void update_banks();
+
+public:
+	void init(shared_ptr<const RomImage> image, size_t ram_size);
 	void write(Address location, Byte data);
 	void save_state(ofstream &file);
 	void load_state(ifstream &file);
@@ -0,0 +1,582 @@
+#pragma once
+
+#include "types.h"
+
+/*
+	Opcode metadata
+
+	One entry per opcode, the 256 base opcodes followed by the 256 CB prefixed ones.
+	Lengths are in bytes and include the CB prefix, cycles are machine cycles
+	(4 clocks each). Conditional jumps, calls and returns list the cost of the
+	branch not being taken in cycles and of it being taken in taken_cycles.
+	The mnemonic names the operand with its kind: d8 / d16 immediate data,
+	a8 offset into $FF00, a16 address, r8 signed offset.
+*/
+
+// Index of the first CB prefixed opcode
+const int CB_PREFIXED = 0x100;
+
+enum OperandKind : Byte
+{
+	OPERAND_NONE,
+	OPERAND_D8,  // immediate byte
+	OPERAND_D16, // immediate word
+	OPERAND_A8,  // $FF00 + byte
+	OPERAND_A16, // address
+	OPERAND_R8,  // signed byte, relative jumps and SP offsets
+	OPERAND_CB   // next byte selects a CB prefixed opcode
+};
+
+struct OpcodeInfo
+{
+	const char* mnemonic;
+	Byte length;
+	Byte cycles;
+	Byte taken_cycles;
+	OperandKind operand;
+};
+
+constexpr OpcodeInfo OPCODE_TABLE[512] =
+{
+	{ "NOP",           1, 1, 1, OPERAND_NONE }, // 0x00
+	{ "LD BC,d16",     3, 3, 3, OPERAND_D16  }, // 0x01
+	{ "LD (BC),A",     1, 2, 2, OPERAND_NONE }, // 0x02
+	{ "INC BC",        1, 2, 2, OPERAND_NONE }, // 0x03
+	{ "INC B",         1, 1, 1, OPERAND_NONE }, // 0x04
+	{ "DEC B",         1, 1, 1, OPERAND_NONE }, // 0x05
+	{ "LD B,d8",       2, 2, 2, OPERAND_D8   }, // 0x06
+	{ "RLCA",          1, 1, 1, OPERAND_NONE }, // 0x07
+	{ "LD (a16),SP",   3, 5, 5, OPERAND_A16  }, // 0x08
+	{ "ADD HL,BC",     1, 2, 2, OPERAND_NONE }, // 0x09
+	{ "LD A,(BC)",     1, 2, 2, OPERAND_NONE }, // 0x0A
+	{ "DEC BC",        1, 2, 2, OPERAND_NONE }, // 0x0B
+	{ "INC C",         1, 1, 1, OPERAND_NONE }, // 0x0C
+	{ "DEC C",         1, 1, 1, OPERAND_NONE }, // 0x0D
+	{ "LD C,d8",       2, 2, 2, OPERAND_D8   }, // 0x0E
+	{ "RRCA",          1, 1, 1, OPERAND_NONE }, // 0x0F
+	{ "STOP",          2, 1, 1, OPERAND_NONE }, // 0x10
+	{ "LD DE,d16",     3, 3, 3, OPERAND_D16  }, // 0x11
+	{ "LD (DE),A",     1, 2, 2, OPERAND_NONE }, // 0x12
+	{ "INC DE",        1, 2, 2, OPERAND_NONE }, // 0x13
+	{ "INC D",         1, 1, 1, OPERAND_NONE }, // 0x14
+	{ "DEC D",         1, 1, 1, OPERAND_NONE }, // 0x15
+	{ "LD D,d8",       2, 2, 2, OPERAND_D8   }, // 0x16
+	{ "RLA",           1, 1, 1, OPERAND_NONE }, // 0x17
+	{ "JR r8",         2, 3, 3, OPERAND_R8   }, // 0x18
+	{ "ADD HL,DE",     1, 2, 2, OPERAND_NONE }, // 0x19
+	{ "LD A,(DE)",     1, 2, 2, OPERAND_NONE }, // 0x1A
+	{ "DEC DE",        1, 2, 2, OPERAND_NONE }, // 0x1B
+	{ "INC E",         1, 1, 1, OPERAND_NONE }, // 0x1C
+	{ "DEC E",         1, 1, 1, OPERAND_NONE }, // 0x1D
+	{ "LD E,d8",       2, 2, 2, OPERAND_D8   }, // 0x1E
+	{ "RRA",           1, 1, 1, OPERAND_NONE }, // 0x1F
+	{ "JR NZ,r8",      2, 2, 3, OPERAND_R8   }, // 0x20
+	{ "LD HL,d16",     3, 3, 3, OPERAND_D16  }, // 0x21
+	{ "LD (HL+),A",    1, 2, 2, OPERAND_NONE }, // 0x22
+	{ "INC HL",        1, 2, 2, OPERAND_NONE }, // 0x23
+	{ "INC H",         1, 1, 1, OPERAND_NONE }, // 0x24
+	{ "DEC H",         1, 1, 1, OPERAND_NONE }, // 0x25
+	{ "LD H,d8",       2, 2, 2, OPERAND_D8   }, // 0x26
+	{ "DAA",           1, 1, 1, OPERAND_NONE }, // 0x27
+	{ "JR Z,r8",       2, 2, 3, OPERAND_R8   }, // 0x28
+	{ "ADD HL,HL",     1, 2, 2, OPERAND_NONE }, // 0x29
+	{ "LD A,(HL+)",    1, 2, 2, OPERAND_NONE }, // 0x2A
+	{ "DEC HL",        1, 2, 2, OPERAND_NONE }, // 0x2B
+	{ "INC L",         1, 1, 1, OPERAND_NONE }, // 0x2C
+	{ "DEC L",         1, 1, 1, OPERAND_NONE }, // 0x2D
+	{ "LD L,d8",       2, 2, 2, OPERAND_D8   }, // 0x2E
+	{ "CPL",           1, 1, 1, OPERAND_NONE }, // 0x2F
+	{ "JR NC,r8",      2, 2, 3, OPERAND_R8   }, // 0x30
+	{ "LD SP,d16",     3, 3, 3, OPERAND_D16  }, // 0x31
+	{ "LD (HL-),A",    1, 2, 2, OPERAND_NONE }, // 0x32
+	{ "INC SP",        1, 2, 2, OPERAND_NONE }, // 0x33
+	{ "INC (HL)",      1, 3, 3, OPERAND_NONE }, // 0x34
+	{ "DEC (HL)",      1, 3, 3, OPERAND_NONE }, // 0x35
+	{ "LD (HL),d8",    2, 3, 3, OPERAND_D8   }, // 0x36
+	{ "SCF",           1, 1, 1, OPERAND_NONE }, // 0x37
+	{ "JR C,r8",       2, 2, 3, OPERAND_R8   }, // 0x38
+	{ "ADD HL,SP",     1, 2, 2, OPERAND_NONE }, // 0x39
+	{ "LD A,(HL-)",    1, 2, 2, OPERAND_NONE }, // 0x3A
+	{ "DEC SP",        1, 2, 2, OPERAND_NONE }, // 0x3B
+	{ "INC A",         1, 1, 1, OPERAND_NONE }, // 0x3C
+	{ "DEC A",         1, 1, 1, OPERAND_NONE }, // 0x3D
+	{ "LD A,d8",       2, 2, 2, OPERAND_D8   }, // 0x3E
+	{ "CCF",           1, 1, 1, OPERAND_NONE }, // 0x3F
+	{ "LD B,B",        1, 1, 1, OPERAND_NONE }, // 0x40
+	{ "LD B,C",        1, 1, 1, OPERAND_NONE }, // 0x41
+	{ "LD B,D",        1, 1, 1, OPERAND_NONE }, // 0x42
+	{ "LD B,E",        1, 1, 1, OPERAND_NONE }, // 0x43
+	{ "LD B,H",        1, 1, 1, OPERAND_NONE }, // 0x44
+	{ "LD B,L",        1, 1, 1, OPERAND_NONE }, // 0x45
+	{ "LD B,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x46
+	{ "LD B,A",        1, 1, 1, OPERAND_NONE }, // 0x47
+	{ "LD C,B",        1, 1, 1, OPERAND_NONE }, // 0x48
+	{ "LD C,C",        1, 1, 1, OPERAND_NONE }, // 0x49
+	{ "LD C,D",        1, 1, 1, OPERAND_NONE }, // 0x4A
+	{ "LD C,E",        1, 1, 1, OPERAND_NONE }, // 0x4B
+	{ "LD C,H",        1, 1, 1, OPERAND_NONE }, // 0x4C
+	{ "LD C,L",        1, 1, 1, OPERAND_NONE }, // 0x4D
+	{ "LD C,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x4E
+	{ "LD C,A",        1, 1, 1, OPERAND_NONE }, // 0x4F
+	{ "LD D,B",        1, 1, 1, OPERAND_NONE }, // 0x50
+	{ "LD D,C",        1, 1, 1, OPERAND_NONE }, // 0x51
+	{ "LD D,D",        1, 1, 1, OPERAND_NONE }, // 0x52
+	{ "LD D,E",        1, 1, 1, OPERAND_NONE }, // 0x53
+	{ "LD D,H",        1, 1, 1, OPERAND_NONE }, // 0x54
+	{ "LD D,L",        1, 1, 1, OPERAND_NONE }, // 0x55
+	{ "LD D,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x56
+	{ "LD D,A",        1, 1, 1, OPERAND_NONE }, // 0x57
+	{ "LD E,B",        1, 1, 1, OPERAND_NONE }, // 0x58
+	{ "LD E,C",        1, 1, 1, OPERAND_NONE }, // 0x59
+	{ "LD E,D",        1, 1, 1, OPERAND_NONE }, // 0x5A
+	{ "LD E,E",        1, 1, 1, OPERAND_NONE }, // 0x5B
+	{ "LD E,H",        1, 1, 1, OPERAND_NONE }, // 0x5C
+	{ "LD E,L",        1, 1, 1, OPERAND_NONE }, // 0x5D
+	{ "LD E,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x5E
+	{ "LD E,A",        1, 1, 1, OPERAND_NONE }, // 0x5F
+	{ "LD H,B",        1, 1, 1, OPERAND_NONE }, // 0x60
+	{ "LD H,C",        1, 1, 1, OPERAND_NONE }, // 0x61
+	{ "LD H,D",        1, 1, 1, OPERAND_NONE }, // 0x62
+	{ "LD H,E",        1, 1, 1, OPERAND_NONE }, // 0x63
+	{ "LD H,H",        1, 1, 1, OPERAND_NONE }, // 0x64
+	{ "LD H,L",        1, 1, 1, OPERAND_NONE }, // 0x65
+	{ "LD H,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x66
+	{ "LD H,A",        1, 1, 1, OPERAND_NONE }, // 0x67
+	{ "LD L,B",        1, 1, 1, OPERAND_NONE }, // 0x68
+	{ "LD L,C",        1, 1, 1, OPERAND_NONE }, // 0x69
+	{ "LD L,D",        1, 1, 1, OPERAND_NONE }, // 0x6A
+	{ "LD L,E",        1, 1, 1, OPERAND_NONE }, // 0x6B
+	{ "LD L,H",        1, 1, 1, OPERAND_NONE }, // 0x6C
+	{ "LD L,L",        1, 1, 1, OPERAND_NONE }, // 0x6D
+	{ "LD L,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x6E
+	{ "LD L,A",        1, 1, 1, OPERAND_NONE }, // 0x6F
+	{ "LD (HL),B",     1, 2, 2, OPERAND_NONE }, // 0x70
+	{ "LD (HL),C",     1, 2, 2, OPERAND_NONE }, // 0x71
+	{ "LD (HL),D",     1, 2, 2, OPERAND_NONE }, // 0x72
+	{ "LD (HL),E",     1, 2, 2, OPERAND_NONE }, // 0x73
+	{ "LD (HL),H",     1, 2, 2, OPERAND_NONE }, // 0x74
+	{ "LD (HL),L",     1, 2, 2, OPERAND_NONE }, // 0x75
+	{ "HALT",          1, 1, 1, OPERAND_NONE }, // 0x76
+	{ "LD (HL),A",     1, 2, 2, OPERAND_NONE }, // 0x77
+	{ "LD A,B",        1, 1, 1, OPERAND_NONE }, // 0x78
+	{ "LD A,C",        1, 1, 1, OPERAND_NONE }, // 0x79
+	{ "LD A,D",        1, 1, 1, OPERAND_NONE }, // 0x7A
+	{ "LD A,E",        1, 1, 1, OPERAND_NONE }, // 0x7B
+	{ "LD A,H",        1, 1, 1, OPERAND_NONE }, // 0x7C
+	{ "LD A,L",        1, 1, 1, OPERAND_NONE }, // 0x7D
+	{ "LD A,(HL)",     1, 2, 2, OPERAND_NONE }, // 0x7E
+	{ "LD A,A",        1, 1, 1, OPERAND_NONE }, // 0x7F
+	{ "ADD A,B",       1, 1, 1, OPERAND_NONE }, // 0x80
+	{ "ADD A,C",       1, 1, 1, OPERAND_NONE }, // 0x81
+	{ "ADD A,D",       1, 1, 1, OPERAND_NONE }, // 0x82
+	{ "ADD A,E",       1, 1, 1, OPERAND_NONE }, // 0x83
+	{ "ADD A,H",       1, 1, 1, OPERAND_NONE }, // 0x84
+	{ "ADD A,L",       1, 1, 1, OPERAND_NONE }, // 0x85
+	{ "ADD A,(HL)",    1, 2, 2, OPERAND_NONE }, // 0x86
+	{ "ADD A,A",       1, 1, 1, OPERAND_NONE }, // 0x87
+	{ "ADC A,B",       1, 1, 1, OPERAND_NONE }, // 0x88
+	{ "ADC A,C",       1, 1, 1, OPERAND_NONE }, // 0x89
+	{ "ADC A,D",       1, 1, 1, OPERAND_NONE }, // 0x8A
+	{ "ADC A,E",       1, 1, 1, OPERAND_NONE }, // 0x8B
+	{ "ADC A,H",       1, 1, 1, OPERAND_NONE }, // 0x8C
+	{ "ADC A,L",       1, 1, 1, OPERAND_NONE }, // 0x8D
+	{ "ADC A,(HL)",    1, 2, 2, OPERAND_NONE }, // 0x8E
+	{ "ADC A,A",       1, 1, 1, OPERAND_NONE }, // 0x8F
+	{ "SUB B",         1, 1, 1, OPERAND_NONE }, // 0x90
+	{ "SUB C",         1, 1, 1, OPERAND_NONE }, // 0x91
+	{ "SUB D",         1, 1, 1, OPERAND_NONE }, // 0x92
+	{ "SUB E",         1, 1, 1, OPERAND_NONE }, // 0x93
+	{ "SUB H",         1, 1, 1, OPERAND_NONE }, // 0x94
+	{ "SUB L",         1, 1, 1, OPERAND_NONE }, // 0x95
+	{ "SUB (HL)",      1, 2, 2, OPERAND_NONE }, // 0x96
+	{ "SUB A",         1, 1, 1, OPERAND_NONE }, // 0x97
+	{ "SBC A,B",       1, 1, 1, OPERAND_NONE }, // 0x98
+	{ "SBC A,C",       1, 1, 1, OPERAND_NONE }, // 0x99
+	{ "SBC A,D",       1, 1, 1, OPERAND_NONE }, // 0x9A
+	{ "SBC A,E",       1, 1, 1, OPERAND_NONE }, // 0x9B
+	{ "SBC A,H",       1, 1, 1, OPERAND_NONE }, // 0x9C
+	{ "SBC A,L",       1, 1, 1, OPERAND_NONE }, // 0x9D
+	{ "SBC A,(HL)",    1, 2, 2, OPERAND_NONE }, // 0x9E
+	{ "SBC A,A",       1, 1, 1, OPERAND_NONE }, // 0x9F
+	{ "AND B",         1, 1, 1, OPERAND_NONE }, // 0xA0
+	{ "AND C",         1, 1, 1, OPERAND_NONE }, // 0xA1
+	{ "AND D",         1, 1, 1, OPERAND_NONE }, // 0xA2
+	{ "AND E",         1, 1, 1, OPERAND_NONE }, // 0xA3
+	{ "AND H",         1, 1, 1, OPERAND_NONE }, // 0xA4
+	{ "AND L",         1, 1, 1, OPERAND_NONE }, // 0xA5
+	{ "AND (HL)",      1, 2, 2, OPERAND_NONE }, // 0xA6
+	{ "AND A",         1, 1, 1, OPERAND_NONE }, // 0xA7
+	{ "XOR B",         1, 1, 1, OPERAND_NONE }, // 0xA8
+	{ "XOR C",         1, 1, 1, OPERAND_NONE }, // 0xA9
+	{ "XOR D",         1, 1, 1, OPERAND_NONE }, // 0xAA
+	{ "XOR E",         1, 1, 1, OPERAND_NONE }, // 0xAB
+	{ "XOR H",         1, 1, 1, OPERAND_NONE }, // 0xAC
+	{ "XOR L",         1, 1, 1, OPERAND_NONE }, // 0xAD
+	{ "XOR (HL)",      1, 2, 2, OPERAND_NONE }, // 0xAE
+	{ "XOR A",         1, 1, 1, OPERAND_NONE }, // 0xAF
+	{ "OR B",          1, 1, 1, OPERAND_NONE }, // 0xB0
+	{ "OR C",          1, 1, 1, OPERAND_NONE }, // 0xB1
+	{ "OR D",          1, 1, 1, OPERAND_NONE }, // 0xB2
+	{ "OR E",          1, 1, 1, OPERAND_NONE }, // 0xB3
+	{ "OR H",          1, 1, 1, OPERAND_NONE }, // 0xB4
+	{ "OR L",          1, 1, 1, OPERAND_NONE }, // 0xB5
+	{ "OR (HL)",       1, 2, 2, OPERAND_NONE }, // 0xB6
+	{ "OR A",          1, 1, 1, OPERAND_NONE }, // 0xB7
+	{ "CP B",          1, 1, 1, OPERAND_NONE }, // 0xB8
+	{ "CP C",          1, 1, 1, OPERAND_NONE }, // 0xB9
+	{ "CP D",          1, 1, 1, OPERAND_NONE }, // 0xBA
+	{ "CP E",          1, 1, 1, OPERAND_NONE }, // 0xBB
+	{ "CP H",          1, 1, 1, OPERAND_NONE }, // 0xBC
+	{ "CP L",          1, 1, 1, OPERAND_NONE }, // 0xBD
+	{ "CP (HL)",       1, 2, 2, OPERAND_NONE }, // 0xBE
+	{ "CP A",          1, 1, 1, OPERAND_NONE }, // 0xBF
+	{ "RET NZ",        1, 2, 5, OPERAND_NONE }, // 0xC0
+	{ "POP BC",        1, 3, 3, OPERAND_NONE }, // 0xC1
+	{ "JP NZ,a16",     3, 3, 4, OPERAND_A16  }, // 0xC2
+	{ "JP a16",        3, 4, 4, OPERAND_A16  }, // 0xC3
+	{ "CALL NZ,a16",   3, 3, 6, OPERAND_A16  }, // 0xC4
+	{ "PUSH BC",       1, 4, 4, OPERAND_NONE }, // 0xC5
+	{ "ADD A,d8",      2, 2, 2, OPERAND_D8   }, // 0xC6
+	{ "RST 00H",       1, 4, 4, OPERAND_NONE }, // 0xC7
+	{ "RET Z",         1, 2, 5, OPERAND_NONE }, // 0xC8
+	{ "RET",           1, 4, 4, OPERAND_NONE }, // 0xC9
+	{ "JP Z,a16",      3, 3, 4, OPERAND_A16  }, // 0xCA
+	{ "PREFIX CB",     2, 0, 0, OPERAND_CB   }, // 0xCB
+	{ "CALL Z,a16",    3, 3, 6, OPERAND_A16  }, // 0xCC
+	{ "CALL a16",      3, 6, 6, OPERAND_A16  }, // 0xCD
+	{ "ADC A,d8",      2, 2, 2, OPERAND_D8   }, // 0xCE
+	{ "RST 08H",       1, 4, 4, OPERAND_NONE }, // 0xCF
+	{ "RET NC",        1, 2, 5, OPERAND_NONE }, // 0xD0
+	{ "POP DE",        1, 3, 3, OPERAND_NONE }, // 0xD1
+	{ "JP NC,a16",     3, 3, 4, OPERAND_A16  }, // 0xD2
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xD3
+	{ "CALL NC,a16",   3, 3, 6, OPERAND_A16  }, // 0xD4
+	{ "PUSH DE",       1, 4, 4, OPERAND_NONE }, // 0xD5
+	{ "SUB d8",        2, 2, 2, OPERAND_D8   }, // 0xD6
+	{ "RST 10H",       1, 4, 4, OPERAND_NONE }, // 0xD7
+	{ "RET C",         1, 2, 5, OPERAND_NONE }, // 0xD8
+	{ "RETI",          1, 4, 4, OPERAND_NONE }, // 0xD9
+	{ "JP C,a16",      3, 3, 4, OPERAND_A16  }, // 0xDA
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xDB
+	{ "CALL C,a16",    3, 3, 6, OPERAND_A16  }, // 0xDC
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xDD
+	{ "SBC A,d8",      2, 2, 2, OPERAND_D8   }, // 0xDE
+	{ "RST 18H",       1, 4, 4, OPERAND_NONE }, // 0xDF
+	{ "LDH (a8),A",    2, 3, 3, OPERAND_A8   }, // 0xE0
+	{ "POP HL",        1, 3, 3, OPERAND_NONE }, // 0xE1
+	{ "LD (C),A",      1, 2, 2, OPERAND_NONE }, // 0xE2
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xE3
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xE4
+	{ "PUSH HL",       1, 4, 4, OPERAND_NONE }, // 0xE5
+	{ "AND d8",        2, 2, 2, OPERAND_D8   }, // 0xE6
+	{ "RST 20H",       1, 4, 4, OPERAND_NONE }, // 0xE7
+	{ "ADD SP,r8",     2, 4, 4, OPERAND_R8   }, // 0xE8
+	{ "JP (HL)",       1, 1, 1, OPERAND_NONE }, // 0xE9
+	{ "LD (a16),A",    3, 4, 4, OPERAND_A16  }, // 0xEA
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xEB
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xEC
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xED
+	{ "XOR d8",        2, 2, 2, OPERAND_D8   }, // 0xEE
+	{ "RST 28H",       1, 4, 4, OPERAND_NONE }, // 0xEF
+	{ "LDH A,(a8)",    2, 3, 3, OPERAND_A8   }, // 0xF0
+	{ "POP AF",        1, 3, 3, OPERAND_NONE }, // 0xF1
+	{ "LD A,(C)",      1, 2, 2, OPERAND_NONE }, // 0xF2
+	{ "DI",            1, 1, 1, OPERAND_NONE }, // 0xF3
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xF4
+	{ "PUSH AF",       1, 4, 4, OPERAND_NONE }, // 0xF5
+	{ "OR d8",         2, 2, 2, OPERAND_D8   }, // 0xF6
+	{ "RST 30H",       1, 4, 4, OPERAND_NONE }, // 0xF7
+	{ "LD HL,SP+r8",   2, 3, 3, OPERAND_R8   }, // 0xF8
+	{ "LD SP,HL",      1, 2, 2, OPERAND_NONE }, // 0xF9
+	{ "LD A,(a16)",    3, 4, 4, OPERAND_A16  }, // 0xFA
+	{ "EI",            1, 1, 1, OPERAND_NONE }, // 0xFB
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xFC
+	{ "ILLEGAL",       1, 1, 1, OPERAND_NONE }, // 0xFD
+	{ "CP d8",         2, 2, 2, OPERAND_D8   }, // 0xFE
+	{ "RST 38H",       1, 4, 4, OPERAND_NONE }, // 0xFF
+
+	// CB prefixed
+	{ "RLC B",         2, 2, 2, OPERAND_NONE }, // CB 0x00
+	{ "RLC C",         2, 2, 2, OPERAND_NONE }, // CB 0x01
+	{ "RLC D",         2, 2, 2, OPERAND_NONE }, // CB 0x02
+	{ "RLC E",         2, 2, 2, OPERAND_NONE }, // CB 0x03
+	{ "RLC H",         2, 2, 2, OPERAND_NONE }, // CB 0x04
+	{ "RLC L",         2, 2, 2, OPERAND_NONE }, // CB 0x05
+	{ "RLC (HL)",      2, 4, 4, OPERAND_NONE }, // CB 0x06
+	{ "RLC A",         2, 2, 2, OPERAND_NONE }, // CB 0x07
+	{ "RRC B",         2, 2, 2, OPERAND_NONE }, // CB 0x08
+	{ "RRC C",         2, 2, 2, OPERAND_NONE }, // CB 0x09
+	{ "RRC D",         2, 2, 2, OPERAND_NONE }, // CB 0x0A
+	{ "RRC E",         2, 2, 2, OPERAND_NONE }, // CB 0x0B
+	{ "RRC H",         2, 2, 2, OPERAND_NONE }, // CB 0x0C
+	{ "RRC L",         2, 2, 2, OPERAND_NONE }, // CB 0x0D
+	{ "RRC (HL)",      2, 4, 4, OPERAND_NONE }, // CB 0x0E
+	{ "RRC A",         2, 2, 2, OPERAND_NONE }, // CB 0x0F
+	{ "RL B",          2, 2, 2, OPERAND_NONE }, // CB 0x10
+	{ "RL C",          2, 2, 2, OPERAND_NONE }, // CB 0x11
+	{ "RL D",          2, 2, 2, OPERAND_NONE }, // CB 0x12
+	{ "RL E",          2, 2, 2, OPERAND_NONE }, // CB 0x13
+	{ "RL H",          2, 2, 2, OPERAND_NONE }, // CB 0x14
+	{ "RL L",          2, 2, 2, OPERAND_NONE }, // CB 0x15
+	{ "RL (HL)",       2, 4, 4, OPERAND_NONE }, // CB 0x16
+	{ "RL A",          2, 2, 2, OPERAND_NONE }, // CB 0x17
+	{ "RR B",          2, 2, 2, OPERAND_NONE }, // CB 0x18
+	{ "RR C",          2, 2, 2, OPERAND_NONE }, // CB 0x19
+	{ "RR D",          2, 2, 2, OPERAND_NONE }, // CB 0x1A
+	{ "RR E",          2, 2, 2, OPERAND_NONE }, // CB 0x1B
+	{ "RR H",          2, 2, 2, OPERAND_NONE }, // CB 0x1C
+	{ "RR L",          2, 2, 2, OPERAND_NONE }, // CB 0x1D
+	{ "RR (HL)",       2, 4, 4, OPERAND_NONE }, // CB 0x1E
+	{ "RR A",          2, 2, 2, OPERAND_NONE }, // CB 0x1F
+	{ "SLA B",         2, 2, 2, OPERAND_NONE }, // CB 0x20
+	{ "SLA C",         2, 2, 2, OPERAND_NONE }, // CB 0x21
+	{ "SLA D",         2, 2, 2, OPERAND_NONE }, // CB 0x22
+	{ "SLA E",         2, 2, 2, OPERAND_NONE }, // CB 0x23
+	{ "SLA H",         2, 2, 2, OPERAND_NONE }, // CB 0x24
+	{ "SLA L",         2, 2, 2, OPERAND_NONE }, // CB 0x25
+	{ "SLA (HL)",      2, 4, 4, OPERAND_NONE }, // CB 0x26
+	{ "SLA A",         2, 2, 2, OPERAND_NONE }, // CB 0x27
+	{ "SRA B",         2, 2, 2, OPERAND_NONE }, // CB 0x28
+	{ "SRA C",         2, 2, 2, OPERAND_NONE }, // CB 0x29
+	{ "SRA D",         2, 2, 2, OPERAND_NONE }, // CB 0x2A
+	{ "SRA E",         2, 2, 2, OPERAND_NONE }, // CB 0x2B
+	{ "SRA H",         2, 2, 2, OPERAND_NONE }, // CB 0x2C
+	{ "SRA L",         2, 2, 2, OPERAND_NONE }, // CB 0x2D
+	{ "SRA (HL)",      2, 4, 4, OPERAND_NONE }, // CB 0x2E
+	{ "SRA A",         2, 2, 2, OPERAND_NONE }, // CB 0x2F
+	{ "SWAP B",        2, 2, 2, OPERAND_NONE }, // CB 0x30
+	{ "SWAP C",        2, 2, 2, OPERAND_NONE }, // CB 0x31
+	{ "SWAP D",        2, 2, 2, OPERAND_NONE }, // CB 0x32
+	{ "SWAP E",        2, 2, 2, OPERAND_NONE }, // CB 0x33
+	{ "SWAP H",        2, 2, 2, OPERAND_NONE }, // CB 0x34
+	{ "SWAP L",        2, 2, 2, OPERAND_NONE }, // CB 0x35
+	{ "SWAP (HL)",     2, 4, 4, OPERAND_NONE }, // CB 0x36
+	{ "SWAP A",        2, 2, 2, OPERAND_NONE }, // CB 0x37
+	{ "SRL B",         2, 2, 2, OPERAND_NONE }, // CB 0x38
+	{ "SRL C",         2, 2, 2, OPERAND_NONE }, // CB 0x39
+	{ "SRL D",         2, 2, 2, OPERAND_NONE }, // CB 0x3A
+	{ "SRL E",         2, 2, 2, OPERAND_NONE }, // CB 0x3B
+	{ "SRL H",         2, 2, 2, OPERAND_NONE }, // CB 0x3C
+	{ "SRL L",         2, 2, 2, OPERAND_NONE }, // CB 0x3D
+	{ "SRL (HL)",      2, 4, 4, OPERAND_NONE }, // CB 0x3E
+	{ "SRL A",         2, 2, 2, OPERAND_NONE }, // CB 0x3F
+	{ "BIT 0,B",       2, 2, 2, OPERAND_NONE }, // CB 0x40
+	{ "BIT 0,C",       2, 2, 2, OPERAND_NONE }, // CB 0x41
+	{ "BIT 0,D",       2, 2, 2, OPERAND_NONE }, // CB 0x42
+	{ "BIT 0,E",       2, 2, 2, OPERAND_NONE }, // CB 0x43
+	{ "BIT 0,H",       2, 2, 2, OPERAND_NONE }, // CB 0x44
+	{ "BIT 0,L",       2, 2, 2, OPERAND_NONE }, // CB 0x45
+	{ "BIT 0,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x46
+	{ "BIT 0,A",       2, 2, 2, OPERAND_NONE }, // CB 0x47
+	{ "BIT 1,B",       2, 2, 2, OPERAND_NONE }, // CB 0x48
+	{ "BIT 1,C",       2, 2, 2, OPERAND_NONE }, // CB 0x49
+	{ "BIT 1,D",       2, 2, 2, OPERAND_NONE }, // CB 0x4A
+	{ "BIT 1,E",       2, 2, 2, OPERAND_NONE }, // CB 0x4B
+	{ "BIT 1,H",       2, 2, 2, OPERAND_NONE }, // CB 0x4C
+	{ "BIT 1,L",       2, 2, 2, OPERAND_NONE }, // CB 0x4D
+	{ "BIT 1,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x4E
+	{ "BIT 1,A",       2, 2, 2, OPERAND_NONE }, // CB 0x4F
+	{ "BIT 2,B",       2, 2, 2, OPERAND_NONE }, // CB 0x50
+	{ "BIT 2,C",       2, 2, 2, OPERAND_NONE }, // CB 0x51
+	{ "BIT 2,D",       2, 2, 2, OPERAND_NONE }, // CB 0x52
+	{ "BIT 2,E",       2, 2, 2, OPERAND_NONE }, // CB 0x53
+	{ "BIT 2,H",       2, 2, 2, OPERAND_NONE }, // CB 0x54
+	{ "BIT 2,L",       2, 2, 2, OPERAND_NONE }, // CB 0x55
+	{ "BIT 2,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x56
+	{ "BIT 2,A",       2, 2, 2, OPERAND_NONE }, // CB 0x57
+	{ "BIT 3,B",       2, 2, 2, OPERAND_NONE }, // CB 0x58
+	{ "BIT 3,C",       2, 2, 2, OPERAND_NONE }, // CB 0x59
+	{ "BIT 3,D",       2, 2, 2, OPERAND_NONE }, // CB 0x5A
+	{ "BIT 3,E",       2, 2, 2, OPERAND_NONE }, // CB 0x5B
+	{ "BIT 3,H",       2, 2, 2, OPERAND_NONE }, // CB 0x5C
+	{ "BIT 3,L",       2, 2, 2, OPERAND_NONE }, // CB 0x5D
+	{ "BIT 3,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x5E
+	{ "BIT 3,A",       2, 2, 2, OPERAND_NONE }, // CB 0x5F
+	{ "BIT 4,B",       2, 2, 2, OPERAND_NONE }, // CB 0x60
+	{ "BIT 4,C",       2, 2, 2, OPERAND_NONE }, // CB 0x61
+	{ "BIT 4,D",       2, 2, 2, OPERAND_NONE }, // CB 0x62
+	{ "BIT 4,E",       2, 2, 2, OPERAND_NONE }, // CB 0x63
+	{ "BIT 4,H",       2, 2, 2, OPERAND_NONE }, // CB 0x64
+	{ "BIT 4,L",       2, 2, 2, OPERAND_NONE }, // CB 0x65
+	{ "BIT 4,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x66
+	{ "BIT 4,A",       2, 2, 2, OPERAND_NONE }, // CB 0x67
+	{ "BIT 5,B",       2, 2, 2, OPERAND_NONE }, // CB 0x68
+	{ "BIT 5,C",       2, 2, 2, OPERAND_NONE }, // CB 0x69
+	{ "BIT 5,D",       2, 2, 2, OPERAND_NONE }, // CB 0x6A
+	{ "BIT 5,E",       2, 2, 2, OPERAND_NONE }, // CB 0x6B
+	{ "BIT 5,H",       2, 2, 2, OPERAND_NONE }, // CB 0x6C
+	{ "BIT 5,L",       2, 2, 2, OPERAND_NONE }, // CB 0x6D
+	{ "BIT 5,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x6E
+	{ "BIT 5,A",       2, 2, 2, OPERAND_NONE }, // CB 0x6F
+	{ "BIT 6,B",       2, 2, 2, OPERAND_NONE }, // CB 0x70
+	{ "BIT 6,C",       2, 2, 2, OPERAND_NONE }, // CB 0x71
+	{ "BIT 6,D",       2, 2, 2, OPERAND_NONE }, // CB 0x72
+	{ "BIT 6,E",       2, 2, 2, OPERAND_NONE }, // CB 0x73
+	{ "BIT 6,H",       2, 2, 2, OPERAND_NONE }, // CB 0x74
+	{ "BIT 6,L",       2, 2, 2, OPERAND_NONE }, // CB 0x75
+	{ "BIT 6,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x76
+	{ "BIT 6,A",       2, 2, 2, OPERAND_NONE }, // CB 0x77
+	{ "BIT 7,B",       2, 2, 2, OPERAND_NONE }, // CB 0x78
+	{ "BIT 7,C",       2, 2, 2, OPERAND_NONE }, // CB 0x79
+	{ "BIT 7,D",       2, 2, 2, OPERAND_NONE }, // CB 0x7A
+	{ "BIT 7,E",       2, 2, 2, OPERAND_NONE }, // CB 0x7B
+	{ "BIT 7,H",       2, 2, 2, OPERAND_NONE }, // CB 0x7C
+	{ "BIT 7,L",       2, 2, 2, OPERAND_NONE }, // CB 0x7D
+	{ "BIT 7,(HL)",    2, 3, 3, OPERAND_NONE }, // CB 0x7E
+	{ "BIT 7,A",       2, 2, 2, OPERAND_NONE }, // CB 0x7F
+	{ "RES 0,B",       2, 2, 2, OPERAND_NONE }, // CB 0x80
+	{ "RES 0,C",       2, 2, 2, OPERAND_NONE }, // CB 0x81
+	{ "RES 0,D",       2, 2, 2, OPERAND_NONE }, // CB 0x82
+	{ "RES 0,E",       2, 2, 2, OPERAND_NONE }, // CB 0x83
+	{ "RES 0,H",       2, 2, 2, OPERAND_NONE }, // CB 0x84
+	{ "RES 0,L",       2, 2, 2, OPERAND_NONE }, // CB 0x85
+	{ "RES 0,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0x86
+	{ "RES 0,A",       2, 2, 2, OPERAND_NONE }, // CB 0x87
+	{ "RES 1,B",       2, 2, 2, OPERAND_NONE }, // CB 0x88
+	{ "RES 1,C",       2, 2, 2, OPERAND_NONE }, // CB 0x89
+	{ "RES 1,D",       2, 2, 2, OPERAND_NONE }, // CB 0x8A
+	{ "RES 1,E",       2, 2, 2, OPERAND_NONE }, // CB 0x8B
+	{ "RES 1,H",       2, 2, 2, OPERAND_NONE }, // CB 0x8C
+	{ "RES 1,L",       2, 2, 2, OPERAND_NONE }, // CB 0x8D
+	{ "RES 1,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0x8E
+	{ "RES 1,A",       2, 2, 2, OPERAND_NONE }, // CB 0x8F
+	{ "RES 2,B",       2, 2, 2, OPERAND_NONE }, // CB 0x90
+	{ "RES 2,C",       2, 2, 2, OPERAND_NONE }, // CB 0x91
+	{ "RES 2,D",       2, 2, 2, OPERAND_NONE }, // CB 0x92
+	{ "RES 2,E",       2, 2, 2, OPERAND_NONE }, // CB 0x93
+	{ "RES 2,H",       2, 2, 2, OPERAND_NONE }, // CB 0x94
+	{ "RES 2,L",       2, 2, 2, OPERAND_NONE }, // CB 0x95
+	{ "RES 2,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0x96
+	{ "RES 2,A",       2, 2, 2, OPERAND_NONE }, // CB 0x97
+	{ "RES 3,B",       2, 2, 2, OPERAND_NONE }, // CB 0x98
+	{ "RES 3,C",       2, 2, 2, OPERAND_NONE }, // CB 0x99
+	{ "RES 3,D",       2, 2, 2, OPERAND_NONE }, // CB 0x9A
+	{ "RES 3,E",       2, 2, 2, OPERAND_NONE }, // CB 0x9B
+	{ "RES 3,H",       2, 2, 2, OPERAND_NONE }, // CB 0x9C
+	{ "RES 3,L",       2, 2, 2, OPERAND_NONE }, // CB 0x9D
+	{ "RES 3,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0x9E
+	{ "RES 3,A",       2, 2, 2, OPERAND_NONE }, // CB 0x9F
+	{ "RES 4,B",       2, 2, 2, OPERAND_NONE }, // CB 0xA0
+	{ "RES 4,C",       2, 2, 2, OPERAND_NONE }, // CB 0xA1
+	{ "RES 4,D",       2, 2, 2, OPERAND_NONE }, // CB 0xA2
+	{ "RES 4,E",       2, 2, 2, OPERAND_NONE }, // CB 0xA3
+	{ "RES 4,H",       2, 2, 2, OPERAND_NONE }, // CB 0xA4
+	{ "RES 4,L",       2, 2, 2, OPERAND_NONE }, // CB 0xA5
+	{ "RES 4,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xA6
+	{ "RES 4,A",       2, 2, 2, OPERAND_NONE }, // CB 0xA7
+	{ "RES 5,B",       2, 2, 2, OPERAND_NONE }, // CB 0xA8
+	{ "RES 5,C",       2, 2, 2, OPERAND_NONE }, // CB 0xA9
+	{ "RES 5,D",       2, 2, 2, OPERAND_NONE }, // CB 0xAA
+	{ "RES 5,E",       2, 2, 2, OPERAND_NONE }, // CB 0xAB
+	{ "RES 5,H",       2, 2, 2, OPERAND_NONE }, // CB 0xAC
+	{ "RES 5,L",       2, 2, 2, OPERAND_NONE }, // CB 0xAD
+	{ "RES 5,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xAE
+	{ "RES 5,A",       2, 2, 2, OPERAND_NONE }, // CB 0xAF
+	{ "RES 6,B",       2, 2, 2, OPERAND_NONE }, // CB 0xB0
+	{ "RES 6,C",       2, 2, 2, OPERAND_NONE }, // CB 0xB1
+	{ "RES 6,D",       2, 2, 2, OPERAND_NONE }, // CB 0xB2
+	{ "RES 6,E",       2, 2, 2, OPERAND_NONE }, // CB 0xB3
+	{ "RES 6,H",       2, 2, 2, OPERAND_NONE }, // CB 0xB4
+	{ "RES 6,L",       2, 2, 2, OPERAND_NONE }, // CB 0xB5
+	{ "RES 6,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xB6
+	{ "RES 6,A",       2, 2, 2, OPERAND_NONE }, // CB 0xB7
+	{ "RES 7,B",       2, 2, 2, OPERAND_NONE }, // CB 0xB8
+	{ "RES 7,C",       2, 2, 2, OPERAND_NONE }, // CB 0xB9
+	{ "RES 7,D",       2, 2, 2, OPERAND_NONE }, // CB 0xBA
+	{ "RES 7,E",       2, 2, 2, OPERAND_NONE }, // CB 0xBB
+	{ "RES 7,H",       2, 2, 2, OPERAND_NONE }, // CB 0xBC
+	{ "RES 7,L",       2, 2, 2, OPERAND_NONE }, // CB 0xBD
+	{ "RES 7,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xBE
+	{ "RES 7,A",       2, 2, 2, OPERAND_NONE }, // CB 0xBF
+	{ "SET 0,B",       2, 2, 2, OPERAND_NONE }, // CB 0xC0
+	{ "SET 0,C",       2, 2, 2, OPERAND_NONE }, // CB 0xC1
+	{ "SET 0,D",       2, 2, 2, OPERAND_NONE }, // CB 0xC2
+	{ "SET 0,E",       2, 2, 2, OPERAND_NONE }, // CB 0xC3
+	{ "SET 0,H",       2, 2, 2, OPERAND_NONE }, // CB 0xC4
+	{ "SET 0,L",       2, 2, 2, OPERAND_NONE }, // CB 0xC5
+	{ "SET 0,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xC6
+	{ "SET 0,A",       2, 2, 2, OPERAND_NONE }, // CB 0xC7
+	{ "SET 1,B",       2, 2, 2, OPERAND_NONE }, // CB 0xC8
+	{ "SET 1,C",       2, 2, 2, OPERAND_NONE }, // CB 0xC9
+	{ "SET 1,D",       2, 2, 2, OPERAND_NONE }, // CB 0xCA
+	{ "SET 1,E",       2, 2, 2, OPERAND_NONE }, // CB 0xCB
+	{ "SET 1,H",       2, 2, 2, OPERAND_NONE }, // CB 0xCC
+	{ "SET 1,L",       2, 2, 2, OPERAND_NONE }, // CB 0xCD
+	{ "SET 1,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xCE
+	{ "SET 1,A",       2, 2, 2, OPERAND_NONE }, // CB 0xCF
+	{ "SET 2,B",       2, 2, 2, OPERAND_NONE }, // CB 0xD0
+	{ "SET 2,C",       2, 2, 2, OPERAND_NONE }, // CB 0xD1
+	{ "SET 2,D",       2, 2, 2, OPERAND_NONE }, // CB 0xD2
+	{ "SET 2,E",       2, 2, 2, OPERAND_NONE }, // CB 0xD3
+	{ "SET 2,H",       2, 2, 2, OPERAND_NONE }, // CB 0xD4
+	{ "SET 2,L",       2, 2, 2, OPERAND_NONE }, // CB 0xD5
+	{ "SET 2,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xD6
+	{ "SET 2,A",       2, 2, 2, OPERAND_NONE }, // CB 0xD7
+	{ "SET 3,B",       2, 2, 2, OPERAND_NONE }, // CB 0xD8
+	{ "SET 3,C",       2, 2, 2, OPERAND_NONE }, // CB 0xD9
+	{ "SET 3,D",       2, 2, 2, OPERAND_NONE }, // CB 0xDA
+	{ "SET 3,E",       2, 2, 2, OPERAND_NONE }, // CB 0xDB
+	{ "SET 3,H",       2, 2, 2, OPERAND_NONE }, // CB 0xDC
+	{ "SET 3,L",       2, 2, 2, OPERAND_NONE }, // CB 0xDD
+	{ "SET 3,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xDE
+	{ "SET 3,A",       2, 2, 2, OPERAND_NONE }, // CB 0xDF
+	{ "SET 4,B",       2, 2, 2, OPERAND_NONE }, // CB 0xE0
+	{ "SET 4,C",       2, 2, 2, OPERAND_NONE }, // CB 0xE1
+	{ "SET 4,D",       2, 2, 2, OPERAND_NONE }, // CB 0xE2
+	{ "SET 4,E",       2, 2, 2, OPERAND_NONE }, // CB 0xE3
+	{ "SET 4,H",       2, 2, 2, OPERAND_NONE }, // CB 0xE4
+	{ "SET 4,L",       2, 2, 2, OPERAND_NONE }, // CB 0xE5
+	{ "SET 4,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xE6
+	{ "SET 4,A",       2, 2, 2, OPERAND_NONE }, // CB 0xE7
+	{ "SET 5,B",       2, 2, 2, OPERAND_NONE }, // CB 0xE8
+	{ "SET 5,C",       2, 2, 2, OPERAND_NONE }, // CB 0xE9
+	{ "SET 5,D",       2, 2, 2, OPERAND_NONE }, // CB 0xEA
+	{ "SET 5,E",       2, 2, 2, OPERAND_NONE }, // CB 0xEB
+	{ "SET 5,H",       2, 2, 2, OPERAND_NONE }, // CB 0xEC
+	{ "SET 5,L",       2, 2, 2, OPERAND_NONE }, // CB 0xED
+	{ "SET 5,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xEE
+	{ "SET 5,A",       2, 2, 2, OPERAND_NONE }, // CB 0xEF
+	{ "SET 6,B",       2, 2, 2, OPERAND_NONE }, // CB 0xF0
+	{ "SET 6,C",       2, 2, 2, OPERAND_NONE }, // CB 0xF1
+	{ "SET 6,D",       2, 2, 2, OPERAND_NONE }, // CB 0xF2
+	{ "SET 6,E",       2, 2, 2, OPERAND_NONE }, // CB 0xF3
+	{ "SET 6,H",       2, 2, 2, OPERAND_NONE }, // CB 0xF4
+	{ "SET 6,L",       2, 2, 2, OPERAND_NONE }, // CB 0xF5
+	{ "SET 6,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xF6
+	{ "SET 6,A",       2, 2, 2, OPERAND_NONE }, // CB 0xF7
+	{ "SET 7,B",       2, 2, 2, OPERAND_NONE }, // CB 0xF8
+	{ "SET 7,C",       2, 2, 2, OPERAND_NONE }, // CB 0xF9
+	{ "SET 7,D",       2, 2, 2, OPERAND_NONE }, // CB 0xFA
+	{ "SET 7,E",       2, 2, 2, OPERAND_NONE }, // CB 0xFB
+	{ "SET 7,H",       2, 2, 2, OPERAND_NONE }, // CB 0xFC
+	{ "SET 7,L",       2, 2, 2, OPERAND_NONE }, // CB 0xFD
+	{ "SET 7,(HL)",    2, 4, 4, OPERAND_NONE }, // CB 0xFE
+	{ "SET 7,A",       2, 2, 2, OPERAND_NONE }  // CB 0xFF
+};
+
+// Length has to match the operand, the block decoder and JIT rely on it
+constexpr bool opcode_table_consistent()
+{
+	for (int i = 0; i < 512; i++)
+	{
+		const OpcodeInfo& info = OPCODE_TABLE[i];
+		int operand_bytes = 0;
+
+		switch (info.operand)
+		{
+			case OPERAND_D8: case OPERAND_A8: case OPERAND_R8: case OPERAND_CB: operand_bytes = 1; break;
+			case OPERAND_D16: case OPERAND_A16: operand_bytes = 2; break;
+			default: break;
+		}
+
+		// CB prefixed opcodes and STOP carry one more byte than their operands
+		int padding = (i >= CB_PREFIXED || i == 0x10) ? 1 : 0;
+
+		if (info.length != 1 + operand_bytes + padding || info.taken_cycles < info.cycles)
+			return false;
+	}
+
+	return true;
+}
+
+static_assert(opcode_table_consistent(), "OPCODE_TABLE: length or cycles don't match the operands");
@@ -0,0 +1,97 @@
+#include "rom_image.h"
+
+#include <map>
+#include <mutex>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+shared_ptr<const RomImage> RomImage::open(const string& path)
+{
+	// Images still referenced by some instance, by path
+	static mutex images_lock;
+	static map<string, weak_ptr<const RomImage>> images;
+
+	lock_guard<mutex> guard(images_lock);
+
+	shared_ptr<const RomImage> image = images[path].lock();
+
+	if (image)
+		return image;
+
+	shared_ptr<RomImage> created(new RomImage());
+
+	if (!created->map_file(path))
+		return nullptr;
+
+	images[path] = created;
+	return created;
+}
+
+bool RomImage::map_file(const string& path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	// the view keeps the mapping alive once the handles are closed
+	if (mapping)
+	{
+		memory = (const Byte*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		length = (size_t)file_size.QuadPart;
+		CloseHandle(mapping);
+	}
+
+	CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+
+	if (file < 0)
+		return false;
+
+	struct stat status;
+
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		void* region = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+		if (region != MAP_FAILED)
+		{
+			memory = (const Byte*)region;
+			length = status.st_size;
+		}
+	}
+
+	close(file);
+#endif
+
+	return memory != nullptr;
+}
+
+RomImage::~RomImage()
+{
+	if (!memory)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(memory);
+#else
+	munmap((void*)memory, length);
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.h"
+
+/*
+	Cartridge ROM mapped read-only from its file
+
+	Images are reference counted and shared within the process: opening a path that
+	is already open in another Emulator returns the same mapping, so any number of
+	instances running one cartridge cost a single mapping and no heap copies.
+	The mapping is released with the last reference.
+*/
+class RomImage
+{
+public:
+	RomImage(const RomImage&) = delete;
+	RomImage& operator=(const RomImage&) = delete;
+	~RomImage();
+
+	// nullptr if the file can't be opened or is empty
+	static shared_ptr<const RomImage> open(const string& path);
+
+	const Byte* data() const { return memory; }
+	size_t size() const { return length; }
+
+private:
+	RomImage() = default;
+
+	bool map_file(const string& path);
+
+	const Byte* memory = nullptr;
+	size_t length = 0;
+};
@@ -0,0 +1,148 @@
+#include "save_ram.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const chrono::milliseconds SaveRam::FLUSH_DELAY = chrono::milliseconds(500);
+
+unique_ptr<SaveRam> SaveRam::open(const string& path, size_t size)
+{
+	unique_ptr<SaveRam> ram(new SaveRam());
+
+	if (size == 0 || !ram->map_file(path, size))
+		return nullptr;
+
+	ram->writer = thread(&SaveRam::write_back, ram.get());
+	return ram;
+}
+
+bool SaveRam::map_file(const string& path, size_t size)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+
+	if (GetFileSizeEx(file, &file_size))
+		file_length = (size_t)file_size.QuadPart;
+
+	// a mapping larger than the file extends it with zeros
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, (DWORD)size, nullptr);
+
+	if (mapping)
+	{
+		memory = (Byte*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+		length = size;
+		CloseHandle(mapping);
+	}
+
+	if (memory)
+		file_handle = file;
+	else
+		CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (file < 0)
+		return false;
+
+	struct stat status;
+
+	if (fstat(file, &status) == 0)
+		file_length = status.st_size;
+
+	if (file_length >= size || ftruncate(file, size) == 0)
+	{
+		void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+		if (region != MAP_FAILED)
+		{
+			memory = (Byte*)region;
+			length = size;
+		}
+	}
+
+	close(file);
+#endif
+
+	return memory != nullptr;
+}
+
+void SaveRam::flush()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		dirty = true;
+	}
+
+	wake.notify_one();
+}
+
+// Writes the mapping to disk, blocking until it is there
+void SaveRam::sync()
+{
+#if defined(_WIN32)
+	FlushViewOfFile(memory, length);
+	FlushFileBuffers((HANDLE)file_handle);
+#else
+	msync(memory, length, MS_SYNC);
+#endif
+}
+
+// Writer thread, syncs after each burst of flush() calls
+void SaveRam::write_back()
+{
+	unique_lock<mutex> guard(lock);
+
+	while (!closing)
+	{
+		wake.wait(guard, [this] { return dirty || closing; });
+
+		// games often write their save in several steps, wait for the rest of them
+		wake.wait_for(guard, FLUSH_DELAY, [this] { return closing; });
+
+		if (!dirty)
+			continue;
+
+		dirty = false;
+		guard.unlock();
+		sync();
+		guard.lock();
+	}
+}
+
+SaveRam::~SaveRam()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		closing = true;
+	}
+
+	wake.notify_one();
+
+	if (writer.joinable())
+		writer.join();
+
+	if (!memory)
+		return;
+
+	sync();
+
+#if defined(_WIN32)
+	UnmapViewOfFile(memory);
+	CloseHandle((HANDLE)file_handle);
+#else
+	munmap(memory, length);
+#endif
+}
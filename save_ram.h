@@ -0,0 +1,53 @@
+#pragma once
+
+#include "types.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+	Battery backed cartridge RAM mapped read-write from its .sav file
+
+	The game writes straight into the mapping, so a save costs nothing on the
+	emulation thread. flush() only asks the writer thread to sync the mapping to
+	disk; requests arriving within FLUSH_DELAY of each other are written together.
+	The mapping is synced a last time and released on destruction.
+*/
+class SaveRam
+{
+public:
+	SaveRam(const SaveRam&) = delete;
+	SaveRam& operator=(const SaveRam&) = delete;
+	~SaveRam();
+
+	// Creates or extends the file to size bytes, nullptr if it can't be mapped
+	static unique_ptr<SaveRam> open(const string& path, size_t size);
+
+	Byte* data() { return memory; }
+	size_t size() const { return length; }
+	size_t existing() const { return file_length; } // bytes the file held before it was opened
+
+	void flush();
+
+private:
+	SaveRam() = default;
+
+	static const chrono::milliseconds FLUSH_DELAY;
+
+	bool map_file(const string& path, size_t size);
+	void sync();
+	void write_back();
+
+	Byte* memory = nullptr;
+	size_t length = 0;
+	size_t file_length = 0;
+	void* file_handle = nullptr; // Windows only, FlushFileBuffers needs the file
+
+	mutex lock;
+	condition_variable wake;
+	bool dirty = false;
+	bool closing = false;
+	thread writer;
+};
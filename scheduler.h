@@ -0,0 +1,82 @@
+#pragma once
+
+#include "types.h"
+
+/*
+	Master clock and the deadlines of everything that changes state on its own: TIMA
+	overflows, STAT mode changes and new lines, the end of OAM DMA and of the frame.
+	DIV and TIMA themselves are worked out from the clock when read (see Timer).
+
+	The CPU runs until now reaches next and the emulator then brings timers, DMA and LCD up
+	to date in one go (see Emulator::sync) and schedules the events again. Writes to the
+	registers those events depend on ask for a sync after the current instruction instead.
+	There are only a handful of events, so next is a minimum over a fixed array.
+*/
+class Scheduler
+{
+public:
+	enum Event
+	{
+		EVENT_TIMER,   // TIMA overflow
+		EVENT_LCD,     // STAT mode change or next line
+		EVENT_DMA,     // end of an OAM DMA transfer
+		EVENT_FRAME,   // end of the emulated frame
+		EVENTS
+	};
+
+	// An enumerator, so that passing it by reference (fill, min) needs no definition
+	enum : unsigned long long { NEVER = ~0ULL };
+
+	unsigned long long now = 0;  // cycles since power on
+	unsigned long long next = 0; // earliest deadline, 0 while a sync is requested
+
+	Scheduler()
+	{
+		fill(begin(deadlines), end(deadlines), NEVER);
+	}
+
+	void schedule(Event event, unsigned long long cycle) { deadlines[event] = cycle; }
+	void cancel(Event event) { deadlines[event] = NEVER; }
+	unsigned long long deadline(Event event) const { return deadlines[event]; }
+
+	// Earliest event, regardless of sync requests
+	unsigned long long earliest() const
+	{
+		return *min_element(begin(deadlines), end(deadlines));
+	}
+
+	// Ends the CPU run after the current instruction
+	void stop()
+	{
+		next = 0;
+	}
+
+	// Sync after the current instruction
+	void request_sync()
+	{
+		sync_requested = true;
+		next = 0;
+	}
+
+	// A sync was requested or an event is due
+	bool due() const
+	{
+		return sync_requested || now >= earliest();
+	}
+
+	// Called by the sync, which may ask for another one before it reschedules
+	void synced()
+	{
+		sync_requested = false;
+	}
+
+	// Picks next again once the events have been rescheduled
+	void update()
+	{
+		next = sync_requested ? 0 : earliest();
+	}
+
+private:
+	unsigned long long deadlines[EVENTS];
+	bool sync_requested = false;
+};
@@ -0,0 +1,121 @@
+#include "timer.h"
+#include "scheduler.h"
+
+// Cycles between TIMA steps, a falling edge of counter bit 9, 3, 5 or 7
+static const unsigned long long TIMER_PERIODS[4] = { 1024, 16, 64, 256 }; // 4096, 262144, 65536, 16384 Hz
+
+void Timer::reset(unsigned long long now)
+{
+	counter_base = now;
+	tima_base = now;
+	tima_value = 0;
+	tac = 0;
+}
+
+unsigned long long Timer::period() const
+{
+	return TIMER_PERIODS[tac & 0x03];
+}
+
+// The counter bit TAC selects, TIMA steps when it falls
+bool Timer::selected_bit(unsigned long long now) const
+{
+	return enabled() && ((now - counter_base) & (period() / 2)) != 0;
+}
+
+// Falling edges of the selected bit between two cycles. The counter is kept
+// 64 bits wide, which changes nothing as every period divides 65536
+unsigned long long Timer::steps(unsigned long long from, unsigned long long to) const
+{
+	if (!enabled())
+		return 0;
+
+	return (to - counter_base) / period() - (from - counter_base) / period();
+}
+
+// Moves TIMA's reference point to now
+void Timer::settle(unsigned long long now)
+{
+	tima_value += (int)steps(tima_base, now);
+	tima_base = now;
+}
+
+Byte Timer::div(unsigned long long now) const
+{
+	return (Byte)((now - counter_base) >> 8);
+}
+
+Byte Timer::tima(unsigned long long now) const
+{
+	return (Byte)(tima_value + steps(tima_base, now));
+}
+
+// Resetting the counter is a falling edge if the selected bit was set
+void Timer::write_div(unsigned long long now)
+{
+	settle(now);
+
+	if (selected_bit(now))
+		tima_value++;
+
+	counter_base = now;
+}
+
+void Timer::write_tima(unsigned long long now, Byte data)
+{
+	tima_value = data;
+	tima_base = now;
+}
+
+// TIMA sees the selected bit ANDed with the enable bit, so switching to a cleared
+// bit or stopping the timer while the bit is set steps it once more
+void Timer::write_tac(unsigned long long now, Byte data)
+{
+	settle(now);
+
+	bool before = selected_bit(now);
+	tac = data;
+
+	if (before && !selected_bit(now))
+		tima_value++;
+}
+
+unsigned long long Timer::overflow_cycle() const
+{
+	// stepped past $FF by a DIV or TAC write
+	if (tima_value > 0xFF)
+		return tima_base;
+
+	if (!enabled())
+		return Scheduler::NEVER;
+
+	// the (256 - tima_value)th falling edge after tima_base
+	unsigned long long edges = (tima_base - counter_base) / period() + 256 - tima_value;
+	return counter_base + edges * period();
+}
+
+void Timer::overflow(Byte modulo)
+{
+	tima_base = overflow_cycle();
+	tima_value = modulo;
+}
+
+// Next DIV increment or TIMA step, whichever comes first
+unsigned long long Timer::next_step(unsigned long long now) const
+{
+	unsigned long long counter = now - counter_base;
+	unsigned long long next = now + 256 - (counter & 0xFF);
+
+	if (enabled())
+		next = min(next, now + period() - counter % period());
+
+	return next;
+}
+
+void Timer::load(unsigned long long now, Byte div_register, Byte tima_register, Byte tac_register)
+{
+	counter_base = now - (div_register << 8);
+	tima_base = now;
+	tima_value = tima_register;
+	tac = tac_register;
+}
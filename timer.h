@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.h"
+
+/*
+	DIV and TIMA, worked out from the master clock instead of being counted up
+
+	Both hang off a 16-bit counter running at the CPU clock. DIV is its upper byte and
+	TIMA steps whenever the counter bit TAC selects falls from 1 to 0 while the timer is
+	enabled, which is also what makes DIV resets and TAC changes step TIMA at times.
+	The counter is kept as the cycle it was zero at and TIMA as its value at a given
+	cycle, so reads compute them and writes only move those cycles. The emulator only
+	has to step in when TIMA overflows, at overflow_cycle().
+*/
+class Timer
+{
+public:
+	void reset(unsigned long long now);
+
+	Byte div(unsigned long long now) const;
+	Byte tima(unsigned long long now) const;
+
+	void write_div(unsigned long long now);
+	void write_tima(unsigned long long now, Byte data);
+	void write_tac(unsigned long long now, Byte data);
+
+	// Cycle TIMA goes past $FF at, Scheduler::NEVER while it can't
+	unsigned long long overflow_cycle() const;
+	// Reloads TIMA from TMA as of overflow_cycle()
+	void overflow(Byte modulo);
+	// Cycle DIV or TIMA changes at next
+	unsigned long long next_step(unsigned long long now) const;
+
+	// Save states keep DIV, TIMA and TAC in their registers
+	void load(unsigned long long now, Byte div_register, Byte tima_register, Byte tac_register);
+
+private:
+	unsigned long long counter_base = 0; // cycle the counter was zero at
+	unsigned long long tima_base = 0;    // cycle TIMA was tima_value at
+	int tima_value = 0;                  // 256 for an overflow at tima_base that wasn't reloaded yet
+	Byte tac = 0;
+
+	bool enabled() const { return (tac & 0x04) != 0; }
+	unsigned long long period() const;
+	bool selected_bit(unsigned long long now) const;
+	unsigned long long steps(unsigned long long from, unsigned long long to) const;
+	void settle(unsigned long long now);
+};
@@ -2,8 +2,14 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
+#include <memory>
+#include <functional>
+#include <utility>
 #include <cstdlib>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <string>
@@ -11,6 +17,10 @@
 #include <algorithm>
 #include <math.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace std;
 
 typedef uint16_t Address, Byte_2;
@@ -48,34 +58,28 @@ UP = 73,
 DOWN = 74;
 
 //  
-Byte high_byte(Byte_2 target);
-Byte low_byte(Byte_2 target);
-Byte high_nibble(Byte target);
-Byte low_nibble(Byte target);
-Byte_2 combine(Byte high, Byte low);
-bool between(Byte target, int low, int high);
-Byte set_bit(Byte data, Byte bit);
-Byte clear_bit(Byte data, Byte bit);
-bool is_bit_set(Byte data, Byte bit);
 
-//     
-class Pair
-{
-private:
-    Byte& high;
-    Byte& low;
+inline Byte high_byte(Byte_2 target) { return (Byte)(target >> 8); }
+inline Byte low_byte(Byte_2 target) { return (Byte)target; }
+inline Byte high_nibble(Byte target) { return ((target >> 4) & 0xF); }
+inline Byte low_nibble(Byte target) { return (target & 0xF); }
+inline Byte_2 combine(Byte high, Byte low) { return (Byte_2)(high << 8 | low); }
+inline bool between(Byte target, int low, int high) { return (target >= low && target <= high); }
+inline Byte set_bit(Byte data, Byte bit) { return data | (1 << bit); }
+inline Byte clear_bit(Byte data, Byte bit) { return data & (~(1 << bit)); }
+inline bool is_bit_set(Byte data, Byte bit) { return ((data >> bit) & 1) != 0; }
 
-public:
-    Pair(Byte& high_, Byte& low_)
-        : high(high_), low(low_) {}
-    void inc();
-    void dec();
-    void set(Byte_2 value);
-    void set(Byte upper, Byte lower);
-    Byte_2 get();
-
-    Address address();
-};
+// Index of the lowest set bit (count of trailing zeros), data must not be 0
+inline Byte lowest_bit(Byte data)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, data);
+	return (Byte)index;
+#else
+	return (Byte)__builtin_ctz(data);
+#endif
+}
 
 //     
 class MemoryRegister